@@ -0,0 +1,109 @@
+#include "compositor.h"
+
+namespace latero {
+
+// number of taxels blended at a time, small enough for the block to stay in registers
+static const unsigned int BLOCK = 16;
+
+/** @return what a layer gives over what is below, at full opacity */
+template<BlendMode M> static inline double Blend(double below, double v);
+
+template<> inline double Blend<BlendMode::Over>(double /*below*/, double v) { return v; }
+template<> inline double Blend<BlendMode::Add>(double below, double v) { return below + v; }
+template<> inline double Blend<BlendMode::Multiply>(double below, double v) { return below * v; }
+template<> inline double Blend<BlendMode::Max>(double below, double v) { return (v > below) ? v : below; }
+template<> inline double Blend<BlendMode::Min>(double below, double v) { return (v < below) ? v : below; }
+
+/** blend n (at most BLOCK) taxels of a layer into acc */
+template<BlendMode M>
+static inline void BlendBlock(double *__restrict acc, const double *src, const double *mask, double weight, unsigned int n)
+{
+	if (mask)
+	{
+		for (unsigned int i=0; i<n; ++i)
+			acc[i] += weight * mask[i] * (Blend<M>(acc[i], src[i]) - acc[i]);
+	}
+	else
+	{
+		for (unsigned int i=0; i<n; ++i)
+			acc[i] += weight * (Blend<M>(acc[i], src[i]) - acc[i]);
+	}
+}
+
+
+Compositor::Compositor(unsigned int sx, unsigned int sy, double background) :
+	sx_(sx), sy_(sy), background_(background)
+{
+}
+
+int Compositor::AddLayer(const ActuatorImg<double> &src, double weight, BlendMode mode,
+	const ActuatorImg<double> *mask)
+{
+	assert(src.SizeX() == sx_ && src.SizeY() == sy_);
+	assert(!mask || (mask->SizeX() == sx_ && mask->SizeY() == sy_));
+	return AddLayer_(Taxels(src), weight, mode, mask ? Taxels(*mask) : Taxels());
+}
+
+int Compositor::AddLayer_(const Taxels &src, double weight, BlendMode mode, const Taxels &mask)
+{
+	Layer layer = { src, mask, weight, mode };
+	layers_.push_back(layer);
+	return layers_.size() - 1;
+}
+
+void Compositor::SetMask(int layer, const ActuatorImg<double> *mask)
+{
+	assert(!mask || (mask->SizeX() == sx_ && mask->SizeY() == sy_));
+	layers_[layer].mask = mask ? Taxels(*mask) : Taxels();
+}
+
+void Compositor::Compose(ActuatorImg<double> &dest) const
+{
+	assert(dest.SizeX() == sx_ && dest.SizeY() == sy_);
+	Compose_(dest.Data());
+}
+
+void Compositor::Compose_(double *dest) const
+{
+	const unsigned int size = sx_*sy_;
+	for (const Layer &layer : layers_)
+	{
+		assert(!layer.src.img || layer.src.img->Size() == size);
+		assert(!layer.mask.img || layer.mask.img->Size() == size);
+	}
+
+	for (unsigned int start=0; start<size; start+=BLOCK)
+	{
+		const unsigned int n = (size - start < BLOCK) ? size - start : BLOCK;
+		double acc[BLOCK];
+		for (unsigned int i=0; i<n; ++i)
+			acc[i] = background_;
+
+		for (const Layer &layer : layers_)
+		{
+			if (layer.weight == 0)
+				continue;
+			const double *src = layer.src.Get() + start;
+			const double *mask = layer.mask.Get();
+			if (mask)
+				mask += start;
+			switch (layer.mode)
+			{
+				case BlendMode::Over: BlendBlock<BlendMode::Over>(acc, src, mask, layer.weight, n); break;
+				case BlendMode::Add: BlendBlock<BlendMode::Add>(acc, src, mask, layer.weight, n); break;
+				case BlendMode::Multiply: BlendBlock<BlendMode::Multiply>(acc, src, mask, layer.weight, n); break;
+				case BlendMode::Max: BlendBlock<BlendMode::Max>(acc, src, mask, layer.weight, n); break;
+				case BlendMode::Min: BlendBlock<BlendMode::Min>(acc, src, mask, layer.weight, n); break;
+			}
+		}
+
+		// clamped as displayed (NaN is -1.0)
+		for (unsigned int i=0; i<n; ++i)
+		{
+			double v = (acc[i] > -1.0) ? acc[i] : -1.0;
+			dest[start + i] = (v < 1.0) ? v : 1.0;
+		}
+	}
+}
+
+}; // latero
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "tactileimg.h"
+#include <stddef.h>
+#include <vector>
+
+namespace latero {
+
+/** How a layer combines with the layers below it (see Compositor). */
+enum class BlendMode
+{
+	Over,     // the layer replaces what is below
+	Add,      // the layer is added to what is below
+	Multiply, // what is below is multiplied by the layer
+	Max,      // the largest of the layer and what is below
+	Min       // the smallest of the layer and what is below
+};
+
+/**
+ * The Compositor class builds frames from several images, such as a base
+ * texture, a cursor overlay and alerts, stacked in layers. Each layer has a
+ * blend mode, a weight and an optional mask: where the weight times the mask
+ * is a, the result is (1-a)*below + a*blend(below, layer), so that the weight
+ * acts as the opacity of the layer. Values are those of RangeImg, and the
+ * result is clamped to [-1.0, 1.0].
+ *
+ * Layers refer to their images, which the application updates between frames;
+ * the images must outlive the compositor and have the size of the frames when
+ * composing. Compose() reads the taxels through the images, so that they can be
+ * assigned, moved into or resized between frames, and blends all layers in a
+ * single pass over the frame, block by block, without allocating memory or
+ * copying the images.
+ */
+class Compositor
+{
+public:
+	/**
+	 * constructor
+	 * @param sx horizontal size of the frames
+	 * @param sy vertical size of the frames
+	 * @param background value below the bottom layer
+	 */
+	Compositor(unsigned int sx, unsigned int sy, double background = 0.0);
+
+	/**
+	 * Add a layer on top of the others.
+	 * @param src    image of the layer, of the size of the frames
+	 * @param weight opacity of the layer, usually from 0 (hidden) to 1
+	 * @param mode   how the layer combines with the layers below
+	 * @param mask   weight of each taxel, usually from 0 to 1, or NULL for 1 everywhere
+	 * @return index of the layer
+	 */
+	int AddLayer(const ActuatorImg<double> &src, double weight = 1.0, BlendMode mode = BlendMode::Over,
+		const ActuatorImg<double> *mask = NULL);
+
+	template<unsigned int SX, unsigned int SY>
+	int AddLayer(const StaticActuatorImg<double,SX,SY> &src, double weight = 1.0, BlendMode mode = BlendMode::Over,
+		const StaticActuatorImg<double,SX,SY> *mask = NULL)
+	{
+		assert(SX == sx_ && SY == sy_);
+		return AddLayer_(Taxels(src), weight, mode, mask ? Taxels(*mask) : Taxels());
+	}
+
+	/** remove all layers */
+	inline void RemoveLayers() { layers_.clear(); }
+
+	/** @return number of layers */
+	inline size_t GetNbLayers() const { return layers_.size(); }
+
+	/** set the opacity of a layer (a layer of weight 0 is skipped) */
+	inline void SetWeight(int layer, double weight) { layers_[layer].weight = weight; }
+
+	inline double GetWeight(int layer) const { return layers_[layer].weight; }
+
+	inline void SetMode(int layer, BlendMode mode) { layers_[layer].mode = mode; }
+
+	inline BlendMode GetMode(int layer) const { return layers_[layer].mode; }
+
+	/** set the mask of a layer, NULL for none */
+	void SetMask(int layer, const ActuatorImg<double> *mask);
+
+	inline void SetBackground(double v) { background_ = v; }
+
+	/**
+	 * Blend the layers into a frame, which must not be one of their images.
+	 * @param dest frame of the size of the compositor
+	 */
+	void Compose(ActuatorImg<double> &dest) const;
+
+	template<unsigned int SX, unsigned int SY>
+	void Compose(StaticActuatorImg<double,SX,SY> &dest) const
+	{
+		assert(SX == sx_ && SY == sy_);
+		Compose_(dest.Data());
+	}
+
+private:
+	/**
+	 * taxels of an image, looked up at each frame as the buffer of an
+	 * ActuatorImg can change, or stored inline in a StaticActuatorImg
+	 */
+	struct Taxels
+	{
+		Taxels() : img(NULL), data(NULL) {}
+		explicit Taxels(const ActuatorImg<double> &i) : img(&i), data(NULL) {}
+		template<unsigned int SX, unsigned int SY>
+		explicit Taxels(const StaticActuatorImg<double,SX,SY> &i) : img(NULL), data(i.Data()) {}
+
+		/** @return taxel values, NULL for none */
+		inline const double *Get() const { return img ? img->Data() : data; }
+
+		const ActuatorImg<double> *img;
+		const double *data;
+	};
+
+	struct Layer
+	{
+		Taxels src;
+		Taxels mask;
+		double weight;
+		BlendMode mode;
+	};
+
+	int AddLayer_(const Taxels &src, double weight, BlendMode mode, const Taxels &mask);
+	void Compose_(double *dest) const;
+
+	const unsigned int sx_, sy_;
+	double background_;
+	std::vector<Layer> layers_;
+};
+
+}; // latero
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+
+namespace latero {
+
+/**
+ * Lock-free bounded queue passing values in order from one writer thread to
+ * one reader thread. Values are written and read in place, in slots of a fixed
+ * array, so the queue never allocates memory. Neither side ever blocks: the
+ * writer is told when the queue is full.
+ */
+template<class T, unsigned int N>
+class SpscQueue
+{
+	static_assert(N > 0 && (N & (N - 1)) == 0, "the capacity must be a power of two");
+
+public:
+	SpscQueue() : head_(0), tail_(0) {}
+
+	/** @return slot to fill before calling Push(), NULL if the queue is full (writer only) */
+	inline T* WriteSlot()
+	{
+		unsigned int head = head_.load(std::memory_order_relaxed);
+		if (head - tail_.load(std::memory_order_acquire) >= N)
+			return NULL;
+		return &items_[head & (N - 1)];
+	}
+
+	/** make the content of the write slot available to the reader (writer only) */
+	inline void Push()
+	{
+		head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	/** @return oldest value, NULL if the queue is empty (reader only) */
+	inline const T* Front() const
+	{
+		unsigned int tail = tail_.load(std::memory_order_relaxed);
+		if (head_.load(std::memory_order_acquire) == tail)
+			return NULL;
+		return &items_[tail & (N - 1)];
+	}
+
+	/** release the oldest value (reader only) */
+	inline void Pop()
+	{
+		tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	/** @return number of values in the queue (any thread, approximate while they change) */
+	inline unsigned int Size() const
+	{
+		return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+	}
+
+	static constexpr unsigned int Capacity() { return N; }
+
+private:
+	T items_[N];
+	alignas(64) std::atomic<unsigned int> head_; // next slot written
+	alignas(64) std::atomic<unsigned int> tail_; // next slot read
+};
+
+}; // latero
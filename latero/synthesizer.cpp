@@ -0,0 +1,202 @@
+#include "synthesizer.h"
+#include "transitions.h"
+#include <math.h>
+#include <assert.h>
+
+namespace latero {
+
+/**
+ * @return value of a waveform, from -1 to 1
+ * @param p position in the period, from 0 to 1
+ * @param period index of the period
+ */
+template<Waveform W> static inline float Wave(float p, uint32_t period, uint32_t pin);
+
+template<> inline float Wave<Waveform::Sine>(float p, uint32_t, uint32_t)
+{
+	// parabola through the half periods, refined (error below 0.0012)
+	float q = p - 0.5f;
+	float y = 8.0f*q - 16.0f*q*fabsf(q);
+	return -(0.225f*(y*fabsf(y) - y) + y);
+}
+
+template<> inline float Wave<Waveform::Square>(float p, uint32_t, uint32_t)
+{
+	return 1.0f - 2.0f*(int) (2.0f*p);
+}
+
+template<> inline float Wave<Waveform::Triangle>(float p, uint32_t, uint32_t)
+{
+	return 1.0f - 4.0f*fabsf(p - 0.5f);
+}
+
+template<> inline float Wave<Waveform::Sawtooth>(float p, uint32_t, uint32_t)
+{
+	return 2.0f*p - 1.0f;
+}
+
+template<> inline float Wave<Waveform::Noise>(float, uint32_t period, uint32_t pin)
+{
+	// hash of the period and the actuator, so that all of them differ
+	uint32_t h = period*0x9E3779B1u ^ pin*0x85EBCA77u;
+	h ^= h >> 15;
+	h *= 0x2C1B3C6Du;
+	h ^= h >> 12;
+	h *= 0x297A2D39u;
+	h ^= h >> 15;
+	return (h >> 8) * (2.0f / 16777216.0f) - 1.0f;
+}
+
+/**
+ * add a voice to out
+ * @param base position of the voice in its period, from 0 to 1, before the phase of each actuator
+ * @param period index of that period
+ */
+template<Waveform W>
+static void AddWave(float *__restrict out, const float *gain, const float *phase,
+	float base, uint32_t period, float amplitude)
+{
+	for (uint32_t i=0; i<LATERO_NB_PINS; ++i)
+	{
+		// phases are within [0,1), so that truncating is rounding down: unlike
+		// comparisons and floorf(), it is vectorized without SSE4.1 or -fno-trapping-math
+		float c = base + phase[i];
+		int whole = (int) c;
+		out[i] += amplitude * gain[i] * Wave<W>(c - whole, period + whole, i);
+	}
+}
+
+
+Synthesizer::Voice::Voice() :
+	waveform(Waveform::Sine), frequency(0), amplitude(0), gain(1), phase(0)
+{
+}
+
+void Synthesizer::Voice::SetPhaseGradient(float periodsPerPinX, float periodsPerPinY)
+{
+	for (unsigned int y=0; y<phase.SizeY(); ++y)
+		for (unsigned int x=0; x<phase.SizeX(); ++x)
+			phase.Set(x, y, x*periodsPerPinX + y*periodsPerPinY);
+}
+
+
+Synthesizer::Synthesizer() :
+	buffer_(program_)
+{
+}
+
+void Synthesizer::SetVoice(int v, const Voice &voice)
+{
+	assert(v >= 0 && v < MAX_VOICES);
+	Voice &dest = program_.voices[v];
+	dest = voice;
+	for (unsigned int i=0; i<dest.phase.Size(); ++i)
+		dest.phase.Set(i, dest.phase.Get(i) - floorf(dest.phase.Get(i)));
+	Publish_();
+}
+
+void Synthesizer::NoteOn(int v, int64_t time)
+{
+	assert(v >= 0 && v < MAX_VOICES);
+	program_.on[v] = time ? time : Transitions::Now();
+	program_.off[v] = 0;
+	Publish_();
+}
+
+void Synthesizer::NoteOff(int v, int64_t time)
+{
+	assert(v >= 0 && v < MAX_VOICES);
+	if (!program_.on[v] || program_.off[v])
+		return;
+	program_.off[v] = time ? time : Transitions::Now();
+	Publish_();
+}
+
+void Synthesizer::Stop()
+{
+	for (int v=0; v<MAX_VOICES; ++v)
+		program_.on[v] = program_.off[v] = 0;
+	Publish_();
+}
+
+void Synthesizer::Publish_()
+{
+	buffer_.Write(program_);
+}
+
+float Synthesizer::Level_(const Program &p, int v, int64_t now)
+{
+	if (!p.on[v] || now < p.on[v])
+		return -1;
+	const Envelope &env = p.voices[v].envelope;
+
+	// the level reached when the note is released fades from there
+	int64_t end = (p.off[v] && now >= p.off[v]) ? p.off[v] : now;
+	float t = (end - p.on[v]) * 1e-9f;
+	float level;
+	if (t < env.attack)
+		level = t / env.attack;
+	else if (t < env.attack + env.decay)
+		level = 1.0f - (1.0f - env.sustain) * (t - env.attack) / env.decay;
+	else
+		level = env.sustain;
+
+	if (end != now)
+	{
+		float r = (now - end) * 1e-9f;
+		if (r >= env.release)
+			return -1;
+		level *= 1.0f - r / env.release;
+	}
+	return level;
+}
+
+bool Synthesizer::Active(int64_t now)
+{
+	buffer_.Update();
+	const Program &p = buffer_.ReadBuffer();
+	for (int v=0; v<MAX_VOICES; ++v)
+		if (Level_(p, v, now) >= 0)
+			return true;
+	return false;
+}
+
+bool Synthesizer::Render(int64_t now, float *out)
+{
+	buffer_.Update();
+	const Program &p = buffer_.ReadBuffer();
+	bool active = false;
+	for (int v=0; v<MAX_VOICES; ++v)
+	{
+		float level = Level_(p, v, now);
+		if (level < 0)
+			continue;
+		if (!active)
+		{
+			for (int i=0; i<LATERO_NB_PINS; ++i)
+				out[i] = 0;
+			active = true;
+		}
+
+		// the position in the period is kept in double precision, as notes can last long
+		const Voice &voice = p.voices[v];
+		double cycles = voice.frequency * ((now - p.on[v]) * 1e-9);
+		double whole = floor(cycles);
+		float base = cycles - whole;
+		uint32_t period = (uint32_t) (int64_t) whole;
+		float amplitude = voice.amplitude * level;
+		const float *gain = voice.gain.Data();
+		const float *phase = voice.phase.Data();
+		switch (voice.waveform)
+		{
+			case Waveform::Sine: AddWave<Waveform::Sine>(out, gain, phase, base, period, amplitude); break;
+			case Waveform::Square: AddWave<Waveform::Square>(out, gain, phase, base, period, amplitude); break;
+			case Waveform::Triangle: AddWave<Waveform::Triangle>(out, gain, phase, base, period, amplitude); break;
+			case Waveform::Sawtooth: AddWave<Waveform::Sawtooth>(out, gain, phase, base, period, amplitude); break;
+			case Waveform::Noise: AddWave<Waveform::Noise>(out, gain, phase, base, period, amplitude); break;
+		}
+	}
+	return active;
+}
+
+}; // latero
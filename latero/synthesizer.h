@@ -0,0 +1,114 @@
+#pragma once
+
+#include "tactileimg.h"
+#include "triplebuffer.h"
+#include "tl-latero/latero.h"
+#include <stdint.h>
+
+namespace latero {
+
+/** Shape of the oscillation of a voice (see Synthesizer). */
+enum class Waveform
+{
+	Sine,
+	Square,   // 1 over the first half of the period, -1 over the second
+	Triangle, // from -1 at the start of the period to 1 at half of it
+	Sawtooth, // from -1 at the start of the period to 1 at its end
+	Noise     // random values, held for a period
+};
+
+/**
+ * Amplitude of a voice over time, from 0 to 1: rises to 1 over the attack,
+ * falls to the sustain level over the decay, stays there until the note is
+ * released, then falls to 0 over the release. Times are in seconds.
+ */
+struct Envelope
+{
+	float attack = 0;
+	float decay = 0;
+	float sustain = 1;
+	float release = 0;
+};
+
+/**
+ * The Synthesizer class generates vibrations on the actuators, computed each
+ * time a frame is sent to the device rather than by the application. Each of
+ * its voices is an oscillator with an envelope, whose amplitude and phase can
+ * vary from actuator to actuator (e.g. waves travelling across the array).
+ * The voices are added to the frames displayed.
+ *
+ * Voices are set by one thread (the application), and rendered by the thread
+ * that displays frames, without locks or memory allocation.
+ */
+class Synthesizer
+{
+public:
+	/** number of voices */
+	static const int MAX_VOICES = 8;
+
+	/** value of each actuator */
+	typedef StaticActuatorImg<float, LATERO_NB_PINS_X, LATERO_NB_PINS_Y> PinMap;
+
+	struct Voice
+	{
+		Waveform waveform;
+		float frequency;  // [Hz]
+		float amplitude;  // peak value, in RangeImg units
+		Envelope envelope;
+		PinMap gain;      // amplitude of each actuator, relative to amplitude (1 by default)
+		PinMap phase;     // phase of each actuator, in periods (0 by default)
+
+		Voice();
+
+		/** make the phase grow across the array, e.g. for a travelling wave */
+		void SetPhaseGradient(float periodsPerPinX, float periodsPerPinY);
+	};
+
+	Synthesizer();
+
+	/** set a voice, which keeps playing if it was (application thread) */
+	void SetVoice(int v, const Voice &voice);
+
+	/** @return settings of a voice (application thread) */
+	inline const Voice &GetVoice(int v) const { return program_.voices[v]; }
+
+	/**
+	 * Start a note on a voice (application thread).
+	 * @param time time at which the note starts [ns] (see TactileDisplay::Now), 0 for now
+	 */
+	void NoteOn(int v, int64_t time = 0);
+
+	/** release the note of a voice, which fades over the release of its envelope (application thread) */
+	void NoteOff(int v, int64_t time = 0);
+
+	/** silence all voices at once (application thread) */
+	void Stop();
+
+	/** @return true if a voice sounds at a time (display thread) */
+	bool Active(int64_t now);
+
+	/**
+	 * Compute the sum of the voices at a time (display thread).
+	 * @param out LATERO_NB_PINS values
+	 * @return false if no voice sounds, in which case out is left unset
+	 */
+	bool Render(int64_t now, float *out);
+
+private:
+	struct Program
+	{
+		Voice voices[MAX_VOICES];
+		int64_t on[MAX_VOICES] = {};  // time of the last NoteOn() [ns], 0 if none
+		int64_t off[MAX_VOICES] = {}; // time of the last NoteOff() after it [ns], 0 if none
+	};
+
+	/** @return level of the envelope of a voice at a time, negative while the voice is silent */
+	static float Level_(const Program &p, int v, int64_t now);
+
+	void Publish_();
+
+	Program program_; // application thread
+	TripleBuffer<Program> buffer_; // application -> display thread
+};
+
+}; // latero
@@ -1,6 +1,20 @@
 #include "tactiledisplay.h"
+#include "tl-latero/latero_log.h"
+#include "tl-latero/latero_quantize.h"
+#include <algorithm>
 #include <iostream>
+#include <alloca.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 namespace latero {
 
@@ -9,25 +23,27 @@ namespace latero {
 // it might not be necessary. More investigation needed.
 const std::chrono::milliseconds TactileDisplay::debouncing_time = std::chrono::milliseconds(5);
 
-#define IP_ADDRESS "192.168.87.98"
-
-TactileDisplay::TactileDisplay() :
+TactileDisplay::TactileDisplay(const char *address) :
     sx_(8), sy_(8),
     pitchX_(1.2), pitchY_(1.6125), // was 1.4 in McGill version
 	contactorSizeX_(0.5), contactorSizeY_(1.4), // was 1.2 in McGill version
 	offset_(sx_, sy_),
-	fadeDuration_(500), // ms
-    displayedImg_(sx_, sy_),
-    button0_(debouncing_time), button1_(debouncing_time)
+	fadeDuration_(std::chrono::milliseconds(500)), fadeEasing_(Easing::Linear),
+    button0_(debouncing_time), button1_(debouncing_time),
+    latency_(), lastWake_(0), resetLatency_(false),
+    streaming_(false), streamFrames_(0),
+    scheduleStats_(), resetSchedule_(false), lateTolerance_(1000)
 {
 	Precompute();
-	fadeStart_ = std::chrono::system_clock::now();
+	const Frame centered(0.0);
+	displayed_.Set(centered.Data());
 
-	handle_ = new latero_t;
-	int rv = latero_open(handle_, IP_ADDRESS); // TODO: find an elegant way to specify this
+	handle_ = new latero_t(); // zeroed: no field is left undefined before latero_open()
+	int rv = latero_open(handle_, address);
 	if (rv < 0 )
 	{
 	    std::cout << "latero_open() failed\n";
+	    delete handle_;
 	    handle_ = NULL;
 	}
 	else
@@ -37,7 +53,7 @@ TactileDisplay::TactileDisplay() :
 		for (int i=0; i<10; ++i)
 		{
 			latero_pkt_t response;
-			latero_write(handle_, &response);
+			latero_poll(handle_, &response);
    			if ((response.hdr.type == PKT_TYPE_FULLR0) || (response.hdr.type == PKT_TYPE_FULLR1))
 			{
         		if (response.fullr.iostatus != 0x0000)
@@ -50,8 +66,9 @@ TactileDisplay::TactileDisplay() :
 
 		if (failed)
 		{
-		    std::cout << "cannot communicate with latero at " << IP_ADDRESS << "\n";
+		    std::cout << "cannot communicate with latero at " << address << "\n";
 		    latero_close(handle_);
+		    delete handle_;
 		    handle_ = NULL;
 		}
 	}
@@ -59,6 +76,7 @@ TactileDisplay::TactileDisplay() :
 
 TactileDisplay::~TactileDisplay()
 {
+  StopStreaming();
   if (handle_)
   {
     latero_close(handle_);
@@ -67,50 +85,275 @@ TactileDisplay::~TactileDisplay()
 };
 
 
-int TactileDisplay::WriteFrame(const RangeImg &normFrame)
+/***** frames of any precision *****/
+
+template<> TactileDisplay::AnyFrame::Type TactileDisplay::AnyFrame::TypeOf<double>() { return F64; }
+template<> TactileDisplay::AnyFrame::Type TactileDisplay::AnyFrame::TypeOf<float>() { return F32; }
+template<> TactileDisplay::AnyFrame::Type TactileDisplay::AnyFrame::TypeOf<int16_t>() { return Q15; }
+template<> TactileDisplay::AnyFrame::Type TactileDisplay::AnyFrame::TypeOf<uint8_t>() { return U8; }
+
+template<> double *TactileDisplay::AnyFrame::Values<double>() { return f64; }
+template<> float *TactileDisplay::AnyFrame::Values<float>() { return f32; }
+template<> int16_t *TactileDisplay::AnyFrame::Values<int16_t>() { return q15; }
+template<> uint8_t *TactileDisplay::AnyFrame::Values<uint8_t>() { return u8; }
+
+template<class T>
+void TactileDisplay::AnyFrame::Set(const T *values)
 {
-	auto t = std::chrono::system_clock::now() - fadeStart_;
-	if (t > fadeDuration_)
+	type = TypeOf<T>();
+	std::copy(values, values + LATERO_NB_PINS, Values<T>());
+}
+
+/** decode the values of a frame as range values */
+template<class T>
+static void DecodeRange(const T *values, float *range)
+{
+	for (int i=0; i<LATERO_NB_PINS; ++i)
+		range[i] = RangeEncoding<T>::Decode(values[i]);
+}
+
+void TactileDisplay::AnyFrame::Decode(float *range) const
+{
+	switch (type)
 	{
-		displayedImg_ = normFrame;
-		return WriteFrame_(normFrame);
+		case F64: DecodeRange(f64, range); break;
+		case F32: DecodeRange(f32, range); break;
+		case Q15: DecodeRange(q15, range); break;
+		case U8: DecodeRange(u8, range); break;
 	}
-	else
+}
+
+// conversion to blade values, inverted so that -1 is to the left and +1 is to the right
+static void QuantizePins(const double *from, const double *to, double ratio, uint8_t *raw)
+{
+	latero_quantize_pins(from, to, ratio, raw, LATERO_NB_PINS);
+}
+
+static void QuantizePins(const float *from, const float *to, double ratio, uint8_t *raw)
+{
+	latero_quantize_pins_f32(from, to, (float) ratio, raw, LATERO_NB_PINS);
+}
+
+static void QuantizePins(const int16_t *from, const int16_t *to, double ratio, uint8_t *raw)
+{
+	latero_quantize_pins_q15(from, to, ratio, raw, LATERO_NB_PINS);
+}
+
+static void QuantizePins(const uint8_t *from, const uint8_t *to, double ratio, uint8_t *raw)
+{
+	latero_quantize_pins_u8(from, to, ratio, raw, LATERO_NB_PINS);
+}
+
+static void QuantizePins(const float *from, const float *to, const float *ratio, uint8_t *raw)
+{
+	latero_quantize_pins_mix(from, to, ratio, raw, LATERO_NB_PINS);
+}
+
+// calibrated conversion, from range values in single precision
+template<class T>
+static void QuantizePins(const T *from, const T *to, double ratio, const latero_calib_t *calib, uint8_t *raw)
+{
+	float fromF[LATERO_NB_PINS], toF[LATERO_NB_PINS];
+	DecodeRange(to, toF);
+	if (from != to)
+		DecodeRange(from, fromF);
+	latero_quantize_pins_f32_calib(from != to ? fromF : toF, toF, (float) ratio, calib, raw, LATERO_NB_PINS);
+}
+
+static void QuantizePins(const float *from, const float *to, double ratio, const latero_calib_t *calib, uint8_t *raw)
+{
+	latero_quantize_pins_f32_calib(from, to, (float) ratio, calib, raw, LATERO_NB_PINS);
+}
+
+static void QuantizePins(const float *from, const float *to, const float *ratio, const latero_calib_t *calib, uint8_t *raw)
+{
+	latero_quantize_pins_mix_calib(from, to, ratio, calib, raw, LATERO_NB_PINS);
+}
+
+
+template<class T>
+int TactileDisplay::SubmitFrame_(const T *values)
+{
+	if (IsStreaming())
 	{
-		double ratio = std::chrono::duration<double>(t) / std::chrono::duration<double>(fadeDuration_);
-		RangeImg img(sx_, sy_);
-		for (uint i=0; i<img.Size(); ++i)
-			img.Set(i, (1.0-ratio)*displayedImg_.Get(i) + ratio*normFrame.Get(i));
-		return WriteFrame_(img);
+		PublishFrame_(values);
+		return 0;
 	}
+	return DisplayFrame_(values);
 }
 
 
-int TactileDisplay::WriteFrame_(const RangeImg &normFrame)
+int TactileDisplay::WriteFrame(const RangeImg &normFrame)
+{
+	assert(normFrame.Size() == LATERO_NB_PINS);
+	return SubmitFrame_(normFrame.Data());
+}
+
+int TactileDisplay::WriteFrame(const Frame &normFrame)
+{
+	return SubmitFrame_(normFrame.Data());
+}
+
+int TactileDisplay::WriteFrame(const FrameF &normFrame)
+{
+	return SubmitFrame_(normFrame.Data());
+}
+
+int TactileDisplay::WriteFrame(const FrameQ15 &normFrame)
+{
+	return SubmitFrame_(normFrame.Data());
+}
+
+int TactileDisplay::WriteFrame(const Frame8 &normFrame)
+{
+	return SubmitFrame_(normFrame.Data());
+}
+
+
+
+template<class T>
+int TactileDisplay::DisplayFrame_(const T *values)
 {
-	double* mvFrame = new double[normFrame.Size()]; // not very good in realtime
-	for (uint i=0; i<normFrame.Size(); ++i)
+	// fades begin from the frame displayed so far
+	if (transitions_.Pending())
 	{
-		// invert so that -1 is to the left and +1 is to the right
-		float norm = -1*normFrame.Get(i); // still necessary?
-		mvFrame[i] = norm;
+		float target[LATERO_NB_PINS];
+		displayed_.Decode(target);
+		transitions_.Apply(target);
+	}
+	displayed_.Set(values);
+
+	int64_t now = Transitions::Now();
+	float ratio[LATERO_NB_PINS], synth[LATERO_NB_PINS];
+	bool fading = transitions_.Evaluate(now, ratio);
+	bool playing = synth_.Render(now, synth);
+	if (!fading && !playing)
+		return WritePins_(values, values, 1.0);
+
+	// otherwise pins are computed in single precision
+	float target[LATERO_NB_PINS];
+	DecodeRange(values, target);
+	if (playing)
+		for (int i=0; i<LATERO_NB_PINS; ++i)
+			target[i] += synth[i];
+	if (!fading)
+		return WritePins_(target, target, 1.0);
+
+	// while fading, pins are blended at their own pace, and the voices added
+	// to both ends of the fade are added to the blend
+	if (!playing)
+		return WritePins_(transitions_.Sources(), target, ratio);
+	float source[LATERO_NB_PINS];
+	const float *sources = transitions_.Sources();
+	for (int i=0; i<LATERO_NB_PINS; ++i)
+		source[i] = sources[i] + synth[i];
+	return WritePins_(source, target, ratio);
+}
+
+
+int TactileDisplay::DisplayFrame_(const AnyFrame &frame)
+{
+	switch (frame.type)
+	{
+		case AnyFrame::F32: return DisplayFrame_(frame.f32);
+		case AnyFrame::Q15: return DisplayFrame_(frame.q15);
+		case AnyFrame::U8: return DisplayFrame_(frame.u8);
+		default: return DisplayFrame_(frame.f64);
 	}
-	int rv = WriteFrame_(mvFrame,normFrame.Size());
-	delete[] mvFrame;
-	return rv;
+}
+
+
+int TactileDisplay::WriteFrame_(const RangeImg &normFrame)
+{
+	assert(normFrame.Size() == LATERO_NB_PINS);
+	return WritePins_(normFrame.Data(), normFrame.Data(), 1.0);
+}
+
+
+int TactileDisplay::WriteFrame_(const Frame &normFrame)
+{
+	return WritePins_(normFrame.Data(), normFrame.Data(), 1.0);
+}
+
+template<class T, class R>
+int TactileDisplay::WritePins_(const T *from, const T *to, R ratio)
+{
+    if (!handle_) return 0;
+
+    UpdateCalibration_();
+    uint8_t raw[LATERO_NB_PINS];
+    if (const latero_calib_t *calib = latero_get_calibration(handle_))
+        QuantizePins(from, to, ratio, calib, raw);
+    else
+        QuantizePins(from, to, ratio, raw);
+    latero_set_pins_raw(handle_, raw);
+    return Poll_();
 }
 
 int TactileDisplay::WriteFrame_(double *arr, unsigned int size)
 {
     if (!handle_) return 0;
 
+    UpdateCalibration_();
+    latero_set_pins(handle_, arr);
+    return Poll_();
+}
+
+void TactileDisplay::UpdateCalibration_()
+{
+    if (calibBuffer_.Update())
+    {
+        const Calibration &c = calibBuffer_.ReadBuffer();
+        latero_set_calibration(handle_, c.enabled ? &c.calib : NULL);
+    }
+}
+
+int TactileDisplay::Poll_()
+{
+    if (!handle_) return 0;
+
     latero_pkt_t response;
-    int rv = latero_write_pins(handle_, arr, &response);
+    int rv = latero_poll(handle_, &response);
+    HandleResponse_(response);
+    TrackLatency_();
+    return rv;
+}
+
+void TactileDisplay::TrackLatency_()
+{
+    if (resetLatency_.exchange(false, std::memory_order_relaxed))
+        latency_ = LatencyStats();
+
+    // only count each response once
+    latero_timing_t timing;
+    if (latero_get_timing(handle_, &timing) < 0 || timing.wake_ns == lastWake_)
+        return;
+    lastWake_ = timing.wake_ns;
+
+    double rtt = (timing.wake_ns - timing.sent_ns) / 1000.0;
+    latency_.count++;
+    latency_.rttSum += rtt;
+    latency_.rttMax = std::max(latency_.rttMax, rtt);
+    if (timing.kernel_rx_ns != 0)
+    {
+        double network = (timing.kernel_rx_ns - timing.sent_ns) / 1000.0;
+        double wakeup = (timing.wake_ns - timing.kernel_rx_ns) / 1000.0;
+        latency_.kernelCount++;
+        latency_.networkSum += network;
+        latency_.networkMax = std::max(latency_.networkMax, network);
+        latency_.wakeupSum += wakeup;
+        latency_.wakeupMax = std::max(latency_.wakeupMax, wakeup);
+    }
+}
+
+void TactileDisplay::HandleResponse_(latero_pkt_t &response)
+{
     if ((response.hdr.type == PKT_TYPE_FULLR0) || (response.hdr.type == PKT_TYPE_FULLR1))
     {
         if (response.fullr.iostatus == 0x0000)
         {
-            std::cout << "Warning !! The LateroIO status is invalid.\n The Latero I/O interface\nis likely to be unplugged or not powered on.\n";
+            LATERO_LOG_EVERY(1000, LATERO_LOG_WARNING,
+                "The LateroIO status is invalid. The Latero I/O interface is likely to be unplugged or not powered on.");
         }
         else
         {
@@ -122,7 +365,6 @@ int TactileDisplay::WriteFrame_(double *arr, unsigned int size)
             button1_.UpdateState(b1);
         }
     }
-    return rv;
 }
 
 void TactileDisplay::SetFadeDuration(int ms)
@@ -130,10 +372,447 @@ void TactileDisplay::SetFadeDuration(int ms)
 	fadeDuration_ = std::chrono::milliseconds(ms);
 }
 
-void TactileDisplay::BeginFade()
+void TactileDisplay::SetFadeEasing(Easing easing)
+{
+	fadeEasing_ = easing;
+}
+
+bool TactileDisplay::BeginFade(int ms, Easing easing, const FadeMask *mask)
+{
+	return transitions_.Begin(Transitions::Now(), ms * 1000000LL, easing, mask ? mask->Data() : NULL);
+}
+
+bool TactileDisplay::BeginFade()
+{
+	return BeginFade(fadeDuration_.load().count(), fadeEasing_.load());
+}
+
+void TactileDisplay::EndFade()
+{
+	transitions_.End();
+}
+
+bool TactileDisplay::LoadCalibration(const char *path)
+{
+	Calibration &c = calibBuffer_.WriteBuffer();
+	if (latero_calib_load(&c.calib, path) < 0)
+		return false;
+	c.enabled = true;
+	calibBuffer_.Publish();
+	return true;
+}
+
+bool TactileDisplay::SetCalibration(const latero_calib_t *calib)
 {
-	// todo: handle repeated calls...?
-	fadeStart_ = std::chrono::system_clock::now();
+	if (calib && latero_calib_check(calib) < 0)
+		return false;
+	Calibration &c = calibBuffer_.WriteBuffer();
+	c.enabled = (calib != NULL);
+	if (calib)
+		c.calib = *calib;
+	calibBuffer_.Publish();
+	return true;
+}
+
+bool TactileDisplay::StartStreaming()
+{
+	if (!handle_)
+		return false;
+	if (IsStreaming())
+		return true;
+
+	DeviceState state = {};
+	state.x = x_;
+	state.y = y_;
+	state.theta = theta_;
+	state.down[0] = button0_.IsDown();
+	state.down[1] = button1_.IsDown();
+	state.latency = latency_;
+	state.schedule = scheduleStats_;
+	stateBuffer_.Write(state);
+	for (int i=0; i<2; ++i)
+		seenUpEvents_[i] = seenDownEvents_[i] = 0;
+
+	// the thread reports how its real-time settings were applied before streaming
+	std::promise<RealtimeStatus> started;
+	std::future<RealtimeStatus> status = started.get_future();
+	streaming_ = true;
+	streamThread_ = std::thread(&TactileDisplay::StreamLoop_, this, std::move(started));
+	realtimeStatus_ = status.get();
+	return true;
+}
+
+void TactileDisplay::StopStreaming()
+{
+	if (!IsStreaming())
+		return;
+	streaming_ = false;
+	streamThread_.join();
+
+	// frames left would be presented late once streaming starts again
+	while (schedule_.Front())
+		schedule_.Pop();
+}
+
+template<class T>
+void TactileDisplay::PublishFrame_(const T *values)
+{
+	frameBuffer_.WriteBuffer().Set(values);
+	frameBuffer_.Publish();
+}
+
+void TactileDisplay::PublishFrame(const RangeImg &normFrame)
+{
+	assert(normFrame.Size() == LATERO_NB_PINS);
+	PublishFrame_(normFrame.Data());
+}
+
+void TactileDisplay::PublishFrame(const Frame &normFrame)
+{
+	PublishFrame_(normFrame.Data());
+}
+
+void TactileDisplay::PublishFrame(const FrameF &normFrame)
+{
+	PublishFrame_(normFrame.Data());
+}
+
+void TactileDisplay::PublishFrame(const FrameQ15 &normFrame)
+{
+	PublishFrame_(normFrame.Data());
+}
+
+void TactileDisplay::PublishFrame(const Frame8 &normFrame)
+{
+	PublishFrame_(normFrame.Data());
+}
+
+template<class T>
+bool TactileDisplay::ScheduleFrame_(const T *values, int64_t time)
+{
+	if (!IsStreaming())
+		return false;
+	ScheduledFrame *slot = schedule_.WriteSlot();
+	if (!slot)
+		return false;
+	slot->time = time;
+	slot->frame.Set(values);
+	schedule_.Push();
+	return true;
+}
+
+bool TactileDisplay::ScheduleFrame(const RangeImg &normFrame, int64_t time)
+{
+	assert(normFrame.Size() == LATERO_NB_PINS);
+	return ScheduleFrame_(normFrame.Data(), time);
+}
+
+bool TactileDisplay::ScheduleFrame(const Frame &normFrame, int64_t time)
+{
+	return ScheduleFrame_(normFrame.Data(), time);
+}
+
+bool TactileDisplay::ScheduleFrame(const FrameF &normFrame, int64_t time)
+{
+	return ScheduleFrame_(normFrame.Data(), time);
+}
+
+bool TactileDisplay::ScheduleFrame(const FrameQ15 &normFrame, int64_t time)
+{
+	return ScheduleFrame_(normFrame.Data(), time);
+}
+
+bool TactileDisplay::ScheduleFrame(const Frame8 &normFrame, int64_t time)
+{
+	return ScheduleFrame_(normFrame.Data(), time);
+}
+
+const TactileDisplay::ScheduledFrame *TactileDisplay::TakeDueFrame_(int64_t now, int64_t tick)
+{
+	unsigned int depth = schedule_.Size();
+	scheduleStats_.maxDepth = std::max(scheduleStats_.maxDepth, depth);
+
+	// frames due before the middle of the next exchange are sent with this one, the latest wins
+	unsigned int taken = 0;
+	const ScheduledFrame *next;
+	while ((next = schedule_.Front()) && next->time <= now + tick/2)
+	{
+		presenting_ = *next;
+		schedule_.Pop();
+		taken++;
+	}
+	if (taken > 1)
+		scheduleStats_.dropped += taken - 1;
+	return taken ? &presenting_ : NULL;
+}
+
+void TactileDisplay::TrackPresentation_(int64_t time, int64_t sent)
+{
+	double error = (sent - time) / 1000.0;
+	scheduleStats_.presented++;
+	scheduleStats_.errorSum += std::fabs(error);
+	scheduleStats_.errorMax = std::max(scheduleStats_.errorMax, std::fabs(error));
+	if (error > lateTolerance_.load(std::memory_order_relaxed))
+		scheduleStats_.late++;
+}
+
+void TactileDisplay::StreamLoop_(std::promise<RealtimeStatus> started)
+{
+	started.set_value(ApplyRealtimeConfig(realtimeConfig_));
+
+	// the read buffer stays put until the next update
+	const AnyFrame initial = displayed_;
+	const AnyFrame *frame = &initial;
+	DeviceState state = {};
+	bool dirty = true; // the frame must be displayed (again)
+	bool voiced = false; // the last frame displayed had voices of the synthesizer
+	int64_t last = Now(), tick = 0; // period of the exchanges (moving average) [ns]
+	while (streaming_.load(std::memory_order_relaxed))
+	{
+		if (frameBuffer_.Update())
+		{
+			frame = &frameBuffer_.ReadBuffer();
+			dirty = true;
+		}
+
+		int64_t now = Now();
+		tick += (now - last - tick) / 8;
+		last = now;
+		if (resetSchedule_.exchange(false, std::memory_order_relaxed))
+			scheduleStats_ = ScheduleStats();
+		if (const ScheduledFrame *due = TakeDueFrame_(now, tick))
+		{
+			frame = &due->frame;
+			dirty = true;
+			TrackPresentation_(due->time, Now());
+		}
+
+		// once a frame, its fades and voices are displayed, only poll the device
+		bool playing = synth_.Active(now);
+		if (dirty || transitions_.Active() || transitions_.Pending() || playing || voiced)
+		{
+			DisplayFrame_(*frame);
+			dirty = false; // the end of a fade is displayed as the frame itself
+		}
+		else
+			Poll_();
+		voiced = playing; // once silent, the frame is displayed again without the voices
+
+		state.x = x_;
+		state.y = y_;
+		state.theta = theta_;
+		const ButtonDebouncer *buttons[2] = { &button0_, &button1_ };
+		for (int i=0; i<2; ++i)
+		{
+			state.down[i] = buttons[i]->IsDown();
+			if (buttons[i]->UpEvent()) state.upEvents[i]++;
+			if (buttons[i]->DownEvent()) state.downEvents[i]++;
+		}
+		state.latency = latency_;
+		state.schedule = scheduleStats_;
+		stateBuffer_.Write(state);
+		streamFrames_.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+bool TactileDisplay::GetButton(int i, bool &upEvent, bool &downEvent) const
+{
+	if (!IsStreaming())
+	{
+		const ButtonDebouncer &button = i ? button1_ : button0_;
+		upEvent = button.UpEvent();
+		downEvent = button.DownEvent();
+		return button.IsDown();
+	}
+
+	// events are reported once, even if the streaming thread updated the buttons several times since
+	stateBuffer_.Update();
+	const DeviceState &state = stateBuffer_.ReadBuffer();
+	upEvent = (state.upEvents[i] != seenUpEvents_[i]);
+	downEvent = (state.downEvents[i] != seenDownEvents_[i]);
+	seenUpEvents_[i] = state.upEvents[i];
+	seenDownEvents_[i] = state.downEvents[i];
+	return state.down[i];
+}
+
+void TactileDisplay::GetCarrierPose(double &x, double &y, double &theta) const
+{
+	if (!IsStreaming())
+	{
+		x = x_;
+		y = y_;
+		theta = theta_;
+		return;
+	}
+	stateBuffer_.Update();
+	const DeviceState &state = stateBuffer_.ReadBuffer();
+	x = state.x;
+	y = state.y;
+	theta = state.theta;
+}
+
+/** write to every page of a memory block, so that it is mapped */
+static void TouchPages(char *block, size_t size)
+{
+	const size_t page = sysconf(_SC_PAGESIZE);
+	volatile char *p = block;
+	for (size_t i=0; i<size; i+=page)
+		p[i] = 0;
+}
+
+/** room left below the frame of PrefaultStack for the functions it calls [bytes] */
+static const size_t STACK_MARGIN = 64*1024;
+
+/**
+ * grow the stack of the calling thread by size bytes, mapping its pages
+ * @return false if the stack is smaller, in which case it is grown as far as it can safely be
+ */
+static bool __attribute__((noinline)) PrefaultStack(size_t size)
+{
+	bool fits = true;
+#ifdef __linux__
+	pthread_attr_t attr;
+	if (pthread_getattr_np(pthread_self(), &attr) == 0)
+	{
+		void *low;
+		size_t stackSize;
+		char here;
+		if (pthread_attr_getstack(&attr, &low, &stackSize) == 0)
+		{
+			// the stack grows down to low, from the frame of this function
+			size_t left = &here - static_cast<char*>(low);
+			size_t room = left > STACK_MARGIN ? left - STACK_MARGIN : 0;
+			if (size > room)
+			{
+				size = room;
+				fits = false;
+			}
+		}
+		pthread_attr_destroy(&attr);
+	}
+#endif
+	if (size > 0)
+		TouchPages(static_cast<char*>(alloca(size)), size);
+	return fits;
+}
+
+TactileDisplay::RealtimeStatus TactileDisplay::ApplyRealtimeConfig(const RealtimeConfig &config)
+{
+	RealtimeStatus status;
+	auto fail = [&status](const char *setting, const char *reason)
+	{
+		latero_log(LATERO_LOG_WARNING, "Cannot apply real-time setting %s: %s", setting, reason);
+		if (!status.errors.empty())
+			status.errors += "; ";
+		status.errors += std::string(setting) + ": " + reason;
+	};
+
+	// lock memory first, so that the pages prefaulted below stay resident
+	if (config.lockMemory)
+	{
+		if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0)
+			status.lockMemory = true;
+		else
+			fail("lockMemory", strerror(errno));
+	}
+
+	if (config.prefaultHeap > 0 || config.prefaultStack > 0)
+	{
+		status.prefault = true;
+		if (config.prefaultHeap > 0)
+		{
+#ifdef __GLIBC__
+			// keep freed memory in the heap rather than giving it back to the system
+			mallopt(M_TRIM_THRESHOLD, -1);
+			mallopt(M_MMAP_MAX, 0);
+#endif
+			char *block = static_cast<char*>(malloc(config.prefaultHeap));
+			if (block)
+			{
+				TouchPages(block, config.prefaultHeap);
+				free(block);
+			}
+			else
+			{
+				fail("prefaultHeap", strerror(ENOMEM));
+				status.prefault = false;
+			}
+		}
+		if (config.prefaultStack > 0 && !PrefaultStack(config.prefaultStack))
+		{
+			fail("prefaultStack", "larger than the stack of the thread");
+			status.prefault = false;
+		}
+	}
+
+	if (config.priority > 0)
+	{
+		sched_param param = {};
+		param.sched_priority = config.priority;
+		int rv = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if (rv == 0)
+			status.priority = true;
+		else
+			fail("priority", strerror(rv));
+	}
+
+	if (config.cpu >= 0)
+	{
+#ifdef __linux__
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		int rv = EINVAL;
+		if (config.cpu < CPU_SETSIZE)
+		{
+			CPU_SET(config.cpu, &cpus);
+			rv = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+		}
+		if (rv == 0)
+			status.cpu = true;
+		else
+			fail("cpu", strerror(rv));
+#else
+		fail("cpu", "not supported on this system");
+#endif
+	}
+
+	return status;
+}
+
+TactileDisplay::LatencyStats TactileDisplay::GetLatencyStats() const
+{
+	if (!IsStreaming())
+		return latency_;
+	stateBuffer_.Update();
+	return stateBuffer_.ReadBuffer().latency;
+}
+
+void TactileDisplay::ResetLatencyStats()
+{
+	if (IsStreaming())
+		resetLatency_ = true;
+	else
+		latency_ = LatencyStats();
+}
+
+TactileDisplay::ScheduleStats TactileDisplay::GetScheduleStats() const
+{
+	ScheduleStats stats = scheduleStats_;
+	if (IsStreaming())
+	{
+		stateBuffer_.Update();
+		stats = stateBuffer_.ReadBuffer().schedule;
+	}
+	stats.depth = schedule_.Size();
+	return stats;
+}
+
+void TactileDisplay::ResetScheduleStats()
+{
+	if (IsStreaming())
+		resetSchedule_ = true;
+	else
+		scheduleStats_ = ScheduleStats();
 }
 
 void TactileDisplay::Precompute()
@@ -164,22 +843,50 @@ double TactileDisplay::CheckUpdateRate(int seconds)
 		return 0;
 
 	std::cout << "Checking Latero update rate for " << seconds << " s... \n";
+	LatencyStats l0 = GetLatencyStats();
+	double rv;
 
-	long n = 0;
-	latero_pkt_t response;
-	auto t0 = std::chrono::system_clock::now();
-	while ((std::chrono::system_clock::now() - t0) < std::chrono::seconds(seconds))
+	if (IsStreaming())
+	{
+		// count the frames sent by the streaming thread instead
+		unsigned long n0 = streamFrames_.load();
+		auto t0 = std::chrono::system_clock::now();
+		std::this_thread::sleep_for(std::chrono::seconds(seconds));
+		std::chrono::duration<double> elapsed = std::chrono::system_clock::now() - t0;
+		rv = (streamFrames_.load() - n0) / elapsed.count();
+	}
+	else
 	{
-		for (int i=0; i<500; ++i)
+		long n = 0;
+		latero_pkt_t response;
+		auto t0 = std::chrono::system_clock::now();
+		while ((std::chrono::system_clock::now() - t0) < std::chrono::seconds(seconds))
 		{
-			latero_write(handle_, &response);
-			n++;
+			for (int i=0; i<500; ++i)
+			{
+				latero_poll(handle_, &response);
+				TrackLatency_();
+				n++;
+			}
 		}
+		std::chrono::duration<double> elapsed = std::chrono::system_clock::now() - t0;
+		rv = n / elapsed.count();
 	}
-
-	std::chrono::duration<double> elapsed = std::chrono::system_clock::now() - t0;
-	double rv = n / elapsed.count();
 	std::cout << rv << " Hz\n";
+
+	// mean latency over the period (unless the statistics were reset in between)
+	LatencyStats l1 = GetLatencyStats();
+	if (l1.count > l0.count)
+	{
+		std::cout << "round trip: " << (l1.rttSum - l0.rttSum) / (l1.count - l0.count) << " us";
+		if (l1.kernelCount > l0.kernelCount)
+		{
+			unsigned long k = l1.kernelCount - l0.kernelCount;
+			std::cout << " (network: " << (l1.networkSum - l0.networkSum) / k
+			          << " us, wake-up: " << (l1.wakeupSum - l0.wakeupSum) / k << " us)";
+		}
+		std::cout << "\n";
+	}
 	return rv;
 }
 
@@ -187,13 +894,13 @@ double TactileDisplay::CheckUpdateRate(int seconds)
 void TactileDisplay::MonitorButtons(double seconds)
 {
 	// TODO: Updated to std::chrono but could not be tested without a Tactograph.
-    if (!handle_) return;
+    if (!handle_ || IsStreaming()) return;
 	auto start = std::chrono::system_clock::now();
     std::chrono::duration<double> t = std::chrono::system_clock::now() - start;
     while (t.count() < seconds)
     {
         latero_pkt_t response;
-        latero_write(handle_, &response);
+        latero_poll(handle_, &response);
         t = std::chrono::system_clock::now() - start;
         if ((response.hdr.type == PKT_TYPE_FULLR0) || (response.hdr.type == PKT_TYPE_FULLR1))
         {
@@ -214,7 +921,7 @@ void TactileDisplay::MonitorButtons(double seconds)
 void TactileDisplay::MonitorButtonsState(double seconds)
 {
 	// TODO: Updated to std::chrono but could not be tested without a Tactograph.
-    if (!handle_) return;
+    if (!handle_ || IsStreaming()) return;
 
     ButtonDebouncer button0(debouncing_time), button1(debouncing_time);
     auto start = std::chrono::system_clock::now();
@@ -222,7 +929,7 @@ void TactileDisplay::MonitorButtonsState(double seconds)
     while (t.count() < seconds)
     {
         latero_pkt_t response;
-        latero_write(handle_, &response);
+        latero_poll(handle_, &response);
         t = std::chrono::system_clock::now() - start;
         if ((response.hdr.type == PKT_TYPE_FULLR0) || (response.hdr.type == PKT_TYPE_FULLR1))
         {
@@ -3,9 +3,18 @@
 #include "tactileimg.h"
 #include "point.h"
 #include "tl-latero/latero.h"
+#include "tl-latero/latero_calib.h"
 #include "buttondebouncer.h"
+#include "triplebuffer.h"
+#include "spscqueue.h"
+#include "transitions.h"
+#include "synthesizer.h"
 #include <stdint.h>
+#include <atomic>
 #include <chrono>
+#include <future>
+#include <string>
+#include <thread>
 
 
 namespace latero {
@@ -13,11 +22,141 @@ namespace latero {
 class TactileDisplay
 {
 public:
-	TactileDisplay();
+	/**
+	 * Latency of the exchanges with the device [us], split at the time the
+	 * kernel received the response when it is known (see latero_timing_t).
+	 */
+	struct LatencyStats
+	{
+		unsigned long count;           // responses
+		double rttSum, rttMax;         // request sent to response read
+		unsigned long kernelCount;     // responses time-stamped by the kernel
+		double networkSum, networkMax; // request sent to response received by the kernel
+		double wakeupSum, wakeupMax;   // response received by the kernel to response read
+
+		inline double MeanRtt() const { return count ? rttSum / count : 0; }
+		inline double MeanNetwork() const { return kernelCount ? networkSum / kernelCount : 0; }
+		inline double MeanWakeup() const { return kernelCount ? wakeupSum / kernelCount : 0; }
+	};
+
+	/**
+	 * Presentation of the frames scheduled with ScheduleFrame(). The error of a
+	 * frame is the time at which it was sent minus its presentation time [us].
+	 */
+	struct ScheduleStats
+	{
+		unsigned long presented;     // frames sent to the device
+		unsigned long late;          // frames sent later than the late tolerance
+		unsigned long dropped;       // frames superseded by a later frame due at the same exchange
+		double errorSum, errorMax;   // absolute presentation error
+		unsigned int depth;          // frames waiting in the queue
+		unsigned int maxDepth;       // most frames that waited in the queue
+
+		inline double MeanError() const { return presented ? errorSum / presented : 0; }
+	};
+
+	/** number of frames that can wait in the schedule */
+	static const unsigned int SCHEDULE_CAPACITY = 64;
+
+	/**
+	 * Settings that keep a thread exchanging with the device from being preempted
+	 * or stalled by page faults. The defaults leave the thread as is.
+	 */
+	struct RealtimeConfig
+	{
+		int priority = 0;         // SCHED_FIFO priority (1 to 99), 0 to keep the default scheduling
+		int cpu = -1;             // CPU to pin the thread to, -1 to let it run on any CPU
+		bool lockMemory = false;  // lock the current and future pages of the process in memory (mlockall)
+		size_t prefaultStack = 0; // bytes of stack to touch, so that the thread does not fault on it later (up to its stack size)
+		size_t prefaultHeap = 0;  // bytes of heap to touch and keep, so that allocations do not fault
+	};
+
+	/** Outcome of applying a RealtimeConfig. Settings left to their default are not reported. */
+	struct RealtimeStatus
+	{
+		bool priority = false;   // real-time priority set
+		bool cpu = false;        // thread pinned
+		bool lockMemory = false; // memory locked
+		bool prefault = false;   // stack and heap prefaulted
+		std::string errors;      // what could not be applied and why, empty if all was
+
+		inline bool Ok() const { return errors.empty(); }
+	};
+
+	/**
+	 * Frames of the size of the device, stored inline (see StaticActuatorImg), in
+	 * double, float, Q15 or 8-bit precision (see RangeEncoding). Frames are handed
+	 * to the streaming thread and converted to blade values in their own precision.
+	 */
+	typedef StaticRangeImg<LATERO_NB_PINS_X, LATERO_NB_PINS_Y> Frame;
+	typedef StaticRangeImg<LATERO_NB_PINS_X, LATERO_NB_PINS_Y, float> FrameF;
+	typedef StaticRangeImg<LATERO_NB_PINS_X, LATERO_NB_PINS_Y, int16_t> FrameQ15;
+	typedef StaticRangeImg<LATERO_NB_PINS_X, LATERO_NB_PINS_Y, uint8_t> Frame8;
+
+	/** weight of each actuator in a fade, from 0 (not faded) to 1 (see BeginFade) */
+	typedef StaticActuatorImg<float, LATERO_NB_PINS_X, LATERO_NB_PINS_Y> FadeMask;
+
+	/**
+	 * constructor
+	 * @param address IP address of the Latero (e.g. 127.0.0.1 for the latero-sim simulator)
+	 */
+	TactileDisplay(const char *address = LATERO_DEFAULT_IP);
 	virtual ~TactileDisplay();
+
+	/**
+	 * Display a frame. When streaming, the frame is handed over to the streaming
+	 * thread (see PublishFrame) and the call never blocks. Displaying a frame,
+	 * including its fade, does not allocate memory.
+	 */
 	int WriteFrame(const RangeImg &normFrame);
+	int WriteFrame(const Frame &normFrame);
+	int WriteFrame(const FrameF &normFrame);
+	int WriteFrame(const FrameQ15 &normFrame);
+	int WriteFrame(const Frame8 &normFrame);
+
+	/** set the duration and pace of the fades begun with BeginFade() (fades in progress are unchanged) */
 	void SetFadeDuration(int ms);
-	void BeginFade();
+	void SetFadeEasing(Easing easing);
+
+	/**
+	 * Fade from what is displayed now to the frames displayed next. Fades can
+	 * overlap: the actuators still fading start again from where they are.
+	 * Fades are carried out as frames are displayed (by the streaming thread, if
+	 * any), without allocating memory.
+	 * @param ms     duration of the fade
+	 * @param easing pace of the fade
+	 * @param mask   weight of each actuator, or NULL to fade all actuators: an
+	 *               actuator fades over weight*ms, those of weight 0 are left as they are
+	 * @return false if fades are begun faster than frames are displayed (the fade is dropped)
+	 */
+	bool BeginFade(int ms, Easing easing, const FadeMask *mask = NULL);
+	bool BeginFade();
+
+	/** complete all fades at once */
+	void EndFade();
+
+	/**
+	 * @return synthesizer whose voices are added to the frames displayed, and
+	 * computed with each of them (by the streaming thread, if any: vibrations
+	 * then go up to half the rate of the exchanges with the device)
+	 */
+	inline Synthesizer &GetSynthesizer() { return synth_; }
+
+	/**
+	 * Calibrate the actuators with a table for each of them, in place of a
+	 * single linear scale (see latero_calib.h), from the next frame displayed on
+	 * (by the streaming thread, if any). Calibrated frames are quantized in
+	 * single precision.
+	 * @return false if the file cannot be loaded (the calibration is unchanged)
+	 */
+	bool LoadCalibration(const char *path);
+
+	/**
+	 * Set the calibration of the actuators (copied), NULL to go back to the linear scale.
+	 * @return false if a table goes past the travel of the actuators (see
+	 *         latero_calib_check), in which case the calibration is unchanged
+	 */
+	bool SetCalibration(const latero_calib_t *calib);
 
 	/** @return total number of actuators */
 	inline uint GetNbActuators() const { return nbActuators_; }
@@ -58,30 +197,187 @@ public:
 	/** compute update rate over a certain period of time */
 	double CheckUpdateRate(int seconds = 60);
 
+	/** @return latency of the exchanges since the display was opened or ResetLatencyStats() was called */
+	LatencyStats GetLatencyStats() const;
+
+	/** restart the latency statistics (with the next exchange when streaming) */
+	void ResetLatencyStats();
+
     inline bool GetButton0(bool &upEvent, bool &downEvent) const {
-        upEvent = button0_.UpEvent();
-        downEvent = button0_.DownEvent();
-        return button0_.IsDown();
+        return GetButton(0, upEvent, downEvent);
     }
 
     inline bool GetButton1(bool &upEvent, bool &downEvent) const {
-        upEvent = button1_.UpEvent();
-        downEvent = button1_.DownEvent();
-        return button1_.IsDown();
+        return GetButton(1, upEvent, downEvent);
     }    
     
     void MonitorButtons(double seconds);
     void MonitorButtonsState(double seconds);
+
+	/**
+	 * Start a background thread that streams frames to the device as fast as it
+	 * accepts them, updating the carrier position and the buttons at the same rate.
+	 * Frames are then submitted with WriteFrame() or PublishFrame().
+	 * @return false if there is no device
+	 */
+	bool StartStreaming();
+
+	/** stop the streaming thread */
+	void StopStreaming();
+
+	/**
+	 * Set up the streaming thread for real-time operation, from the next call to
+	 * StartStreaming(). Most settings require privileges (e.g. CAP_SYS_NICE and
+	 * CAP_IPC_LOCK, or suitable RLIMIT_RTPRIO and RLIMIT_MEMLOCK limits); those
+	 * that cannot be applied are reported by GetRealtimeStatus() and logged, and
+	 * the thread streams regardless.
+	 */
+	inline void SetRealtimeConfig(const RealtimeConfig &config) { realtimeConfig_ = config; }
+
+	/** @return outcome of applying the real-time settings to the streaming thread when it last started */
+	inline RealtimeStatus GetRealtimeStatus() const { return realtimeStatus_; }
+
+	/**
+	 * Apply real-time settings to the calling thread, for applications that
+	 * drive the device from their own loop rather than streaming. Memory locking
+	 * and heap prefaulting affect the whole process.
+	 */
+	static RealtimeStatus ApplyRealtimeConfig(const RealtimeConfig &config);
+
+	/** @return true if frames are sent by the streaming thread */
+	inline bool IsStreaming() const { return streaming_.load(std::memory_order_relaxed); }
+
+	/**
+	 * Hand a frame over to the streaming thread without blocking. Only the latest
+	 * frame published before the thread picks it up is displayed. Frames should be
+	 * published by one thread at a time.
+	 */
+	void PublishFrame(const RangeImg &normFrame);
+	void PublishFrame(const Frame &normFrame);
+	void PublishFrame(const FrameF &normFrame);
+	void PublishFrame(const FrameQ15 &normFrame);
+	void PublishFrame(const Frame8 &normFrame);
+
+	/**
+	 * Queue a frame to be displayed at a given time by the streaming thread,
+	 * without blocking. Each frame is sent with the exchange with the device
+	 * closest to its time; when several frames are due at the same exchange, only
+	 * the latest is sent, and frames due in the past are sent at once. Frames
+	 * should be scheduled in the order of their times, by one thread at a time.
+	 * Only the streaming thread presents them: frames can only be scheduled
+	 * while streaming (see StartStreaming()), and those still scheduled when
+	 * streaming stops are dropped.
+	 * @param time presentation time [ns], on the clock of Now()
+	 * @return false if not streaming, or if the schedule is full (the frame is dropped)
+	 */
+	bool ScheduleFrame(const RangeImg &normFrame, int64_t time);
+	bool ScheduleFrame(const Frame &normFrame, int64_t time);
+	bool ScheduleFrame(const FrameF &normFrame, int64_t time);
+	bool ScheduleFrame(const FrameQ15 &normFrame, int64_t time);
+	bool ScheduleFrame(const Frame8 &normFrame, int64_t time);
+
+	/** @return current time [ns] on the clock of scheduled frames and fades (monotonic) */
+	static inline int64_t Now() { return Transitions::Now(); }
+
+	/** count the frames sent more than us after their time as late (1000 us by default) */
+	inline void SetLateTolerance(int us) { lateTolerance_ = us; }
+
+	/** @return presentation of the scheduled frames since the display was opened or ResetScheduleStats() was called */
+	ScheduleStats GetScheduleStats() const;
+
+	/** restart the schedule statistics (with the next exchange when streaming) */
+	void ResetScheduleStats();
     
 protected:
 	void Precompute();
 	int WriteFrame_(const RangeImg &normFrame);
+	int WriteFrame_(const Frame &normFrame);
 	int WriteFrame_(double *arr, unsigned int size);
 
+	/** read the carrier position and the buttons, sending the blades only if they were set to new values */
+	int Poll_();
+
+	/** position and orientation of the carrier, as last read from the device */
+	void GetCarrierPose(double &x, double &y, double &theta) const;
+
 	latero_t *handle_;
 	double x_, y_, theta_;
 	
 private:
+	/**
+	 * Values of a frame of any of the frame types, in its own precision: the
+	 * displayed frame, or a frame handed to the streaming thread.
+	 */
+	struct AnyFrame
+	{
+		enum Type { F64, F32, Q15, U8 } type;
+		union
+		{
+			double f64[LATERO_NB_PINS];
+			float f32[LATERO_NB_PINS];
+			int16_t q15[LATERO_NB_PINS];
+			uint8_t u8[LATERO_NB_PINS];
+		};
+
+		template<class T> static Type TypeOf();
+		template<class T> T *Values();
+
+		/** store LATERO_NB_PINS values */
+		template<class T> void Set(const T *values);
+
+		/** decode the values to range values (see RangeEncoding) */
+		void Decode(float *range) const;
+	};
+
+	/** device state published by the streaming thread */
+	struct DeviceState
+	{
+		double x, y, theta;
+		bool down[2];
+		unsigned long upEvents[2], downEvents[2]; // number of events so far
+		LatencyStats latency;
+		ScheduleStats schedule;
+	};
+
+	/** calibration handed to the thread that displays frames */
+	struct Calibration
+	{
+		bool enabled = false;
+		latero_calib_t calib;
+	};
+
+	/** frame handed to the streaming thread with its presentation time */
+	struct ScheduledFrame
+	{
+		int64_t time;
+		AnyFrame frame;
+	};
+
+	bool GetButton(int i, bool &upEvent, bool &downEvent) const;
+	template<class T> int SubmitFrame_(const T *values);
+	template<class T> void PublishFrame_(const T *values);
+	template<class T> bool ScheduleFrame_(const T *values, int64_t time);
+
+	/**
+	 * take the scheduled frames due at the next exchange (streaming thread)
+	 * @return latest frame due, NULL if none
+	 */
+	const ScheduledFrame *TakeDueFrame_(int64_t now, int64_t tick);
+	void TrackPresentation_(int64_t time, int64_t sent);
+	template<class T> int DisplayFrame_(const T *values);
+	int DisplayFrame_(const AnyFrame &frame);
+
+	/**
+	 * display a cross-fade between two frames, converted to blade values in one pass
+	 * @param ratio progress of the fade, for all pins or for each pin
+	 */
+	template<class T, class R> int WritePins_(const T *from, const T *to, R ratio);
+
+	/** take up the calibration last set, if any (thread that displays frames) */
+	void UpdateCalibration_();
+	void HandleResponse_(latero_pkt_t &response);
+	void TrackLatency_();
+	void StreamLoop_(std::promise<RealtimeStatus> started);
     
 	// config
 	const unsigned int sx_, sy_; // frame size
@@ -96,10 +392,31 @@ private:
 	ActuatorImg<Point> offset_;
 	int nbActuators_;
 
-	std::chrono::system_clock::time_point fadeStart_;
-	std::chrono::milliseconds fadeDuration_;
-	RangeImg displayedImg_; // unless fading...
+	std::atomic<std::chrono::milliseconds> fadeDuration_;
+	std::atomic<Easing> fadeEasing_;
+	Transitions transitions_;
+	Synthesizer synth_;
+	TripleBuffer<Calibration> calibBuffer_; // application -> thread that displays frames
+	AnyFrame displayed_; // last frame displayed, which fading actuators are heading to
     ButtonDebouncer button0_, button1_;
+	LatencyStats latency_;
+	int64_t lastWake_; // time at which the last response tracked was read [ns]
+	std::atomic<bool> resetLatency_;
+
+	// streaming
+	RealtimeConfig realtimeConfig_;
+	RealtimeStatus realtimeStatus_;
+	std::thread streamThread_;
+	std::atomic<bool> streaming_;
+	std::atomic<unsigned long> streamFrames_; // number of frames sent by the streaming thread
+	TripleBuffer<AnyFrame> frameBuffer_; // application -> streaming thread
+	SpscQueue<ScheduledFrame, SCHEDULE_CAPACITY> schedule_; // application -> streaming thread
+	ScheduledFrame presenting_; // scheduled frame displayed by the streaming thread
+	ScheduleStats scheduleStats_; // streaming thread
+	std::atomic<bool> resetSchedule_;
+	std::atomic<int> lateTolerance_; // [us]
+	mutable TripleBuffer<DeviceState> stateBuffer_; // streaming thread -> application
+	mutable unsigned long seenUpEvents_[2], seenDownEvents_[2]; // events already reported
 };
 
 
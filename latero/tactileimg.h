@@ -1,6 +1,13 @@
 #pragma once
 
 #include "assert.h"
+#include "taxelpool.h"
+#include <stdint.h>
+#include <array>
+#include <cmath>
+#include <new>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace latero {
@@ -49,7 +56,7 @@ public:
 	ActuatorImg(unsigned int sx, unsigned int sy) :
 		sx_(sx), sy_(sy)
 	{
-		img_ = new TTaxel[sx*sy];
+		img_ = NewTaxels_(sx*sy);
 	};
 
 	/** 
@@ -62,7 +69,7 @@ public:
 	ActuatorImg(unsigned int sx, unsigned int sy, TTaxel v) :
 		sx_(sx), sy_(sy)
 	{
-		img_ = new TTaxel[sx*sy];
+		img_ = NewTaxels_(sx*sy);
 		Set(v);
 	};
 
@@ -73,29 +80,47 @@ public:
 		sx_(p.sx_),
 		sy_(p.sy_)	
 	{
-		img_ = new TTaxel[sx_*sy_];
+		img_ = NewTaxels_(sx_*sy_);
 		for (unsigned int i=0; i<sx_*sy_; ++i)
 			img_[i] = p.img_[i];
 	};
 
+	/**
+	 * Move constructor: takes the buffer of p, which is left empty (0x0),
+	 * unless it belongs to a TaxelArena, in which case the taxels are copied
+	 */
+	ActuatorImg(ActuatorImg&& p) noexcept :
+		img_(p.img_), sx_(p.sx_), sy_(p.sy_)
+	{
+		if (TaxelPool::IsFromArena(p.img_))
+		{
+			img_ = NewTaxels_(sx_*sy_);
+			for (unsigned int i=0; i<sx_*sy_; ++i)
+				img_[i] = std::move(p.img_[i]);
+			return;
+		}
+		p.img_ = nullptr;
+		p.sx_ = p.sy_ = 0;
+	};
+
 	/** 
 	 * destructor 
 	 */
 	virtual ~ActuatorImg()
 	{
-		delete[] img_;
+		DeleteTaxels_(img_, sx_*sy_);
 	};
 
 	/**
 	 * Assignment operator
 	 */
-	ActuatorImg operator= (const ActuatorImg& s)
+	ActuatorImg& operator= (const ActuatorImg& s)
 	{ 
 		if (&s == this) return *this;
 		if (Size() != s.Size())
 		{
-			delete[] img_;
-			img_ = new TTaxel[s.sx_*s.sy_];
+			DeleteTaxels_(img_, sx_*sy_);
+			img_ = NewTaxels_(s.sx_*s.sy_);
 		}
 		sx_ = s.sx_;
 		sy_ = s.sy_;
@@ -104,6 +129,34 @@ public:
 		return *this; 
 	};
 
+	/**
+	 * Move assignment: swaps the buffers, so that s frees the former taxels,
+	 * unless the taxels of s belong to a TaxelArena, in which case they are
+	 * copied into a buffer from where the former one came from
+	 */
+	ActuatorImg& operator= (ActuatorImg&& s) noexcept
+	{
+		if (&s == this) return *this;
+		if (!TaxelPool::IsFromArena(s.img_))
+		{
+			std::swap(img_, s.img_);
+			std::swap(sx_, s.sx_);
+			std::swap(sy_, s.sy_);
+			return *this;
+		}
+		if (Size() != s.Size())
+		{
+			bool fromArena = TaxelPool::IsFromArena(img_);
+			DeleteTaxels_(img_, sx_*sy_);
+			img_ = NewTaxels_(s.sx_*s.sy_, fromArena);
+		}
+		sx_ = s.sx_;
+		sy_ = s.sy_;
+		for (unsigned int i=0; i<sx_*sy_; ++i)
+			img_[i] = std::move(s.img_[i]);
+		return *this;
+	};
+
 	TactileImg* Clone() const
 	{
 		return new ActuatorImg<TTaxel>(*this);
@@ -173,6 +226,17 @@ public:
 		return sx_*sy_;
 	};
 
+	/** @return taxel values, in the order of the linear positions */
+	inline TTaxel* Data()
+	{
+		return img_;
+	};
+
+	inline const TTaxel* Data() const
+	{
+		return img_;
+	};
+
 	inline unsigned int SizeX() const
 	{
 		return sx_;
@@ -197,13 +261,20 @@ public:
 			Set(i, v*Get(i));
 	}
 
-	ActuatorImg<TTaxel> Mult(TTaxel v) const
+	ActuatorImg<TTaxel> Mult(TTaxel v) const &
 	{
 		ActuatorImg<TTaxel> rv = *this;
 		rv.Scale(v);
 		return rv;
 	}
 
+	/** scale a temporary in place rather than copying it */
+	ActuatorImg<TTaxel> Mult(TTaxel v) &&
+	{
+		Scale(v);
+		return std::move(*this);
+	}
+
 
 protected:
 
@@ -219,8 +290,26 @@ protected:
   		return y*sx_ + x;
 	};
 
+	/** @return buffer of n taxels, from TaxelPool */
+	static TTaxel* NewTaxels_(unsigned int n, bool fromArena = true)
+	{
+		static_assert(alignof(TTaxel) <= 16, "taxels are aligned on 16 bytes");
+		TTaxel *p = static_cast<TTaxel*>(TaxelPool::Allocate(n * sizeof(TTaxel), fromArena));
+		for (unsigned int i=0; i<n; ++i)
+			new (p + i) TTaxel;
+		return p;
+	}
+
+	static void DeleteTaxels_(TTaxel* p, unsigned int n)
+	{
+		if (!std::is_trivially_destructible<TTaxel>::value)
+			for (unsigned int i=0; i<n && p; ++i)
+				p[i].~TTaxel();
+		TaxelPool::Free(p);
+	}
+
 	/** 
-	 * buffer holding the taxel values 
+	 * buffer holding the taxel values (see TaxelPool)
 	 */
 	TTaxel* img_;
 
@@ -232,6 +321,80 @@ protected:
 };
 
 
+template<class T> struct RangeEncoding;
+
+/**
+ * Lazy arithmetic on images. Operators on images of doubles (ActuatorImg<double>
+ * and the static images, see the end of this file) build a tree of ImgExpr
+ * nodes instead of computing temporary images; assigning the expression to an
+ * image evaluates it in a single loop, e.g. frame = a*0.3 + b*0.7 - c. Nodes
+ * refer to the images, which must outlive the expression. Taxels are read as
+ * the values they encode (see RangeEncoding).
+ */
+template<class E>
+struct ImgExpr
+{
+	inline const E& Self() const { return static_cast<const E&>(*this); }
+	inline unsigned int SizeX() const { return Self().SizeX(); }
+	inline unsigned int SizeY() const { return Self().SizeY(); }
+	inline unsigned int Size() const { return SizeX()*SizeY(); }
+	inline double operator[](unsigned int i) const { return Self()[i]; }
+};
+
+/** image in an expression */
+template<class TTaxel>
+class ImgLeaf : public ImgExpr<ImgLeaf<TTaxel> >
+{
+public:
+	ImgLeaf(const TTaxel *data, unsigned int sx, unsigned int sy) : data_(data), sx_(sx), sy_(sy) {};
+	inline unsigned int SizeX() const { return sx_; }
+	inline unsigned int SizeY() const { return sy_; }
+	inline double operator[](unsigned int i) const { return RangeEncoding<TTaxel>::Decode(data_[i]); }
+
+private:
+	const TTaxel *data_;
+	unsigned int sx_, sy_;
+};
+
+/** taxel by taxel operation on two expressions of the same size */
+template<class L, class R, class Op>
+class ImgBinary : public ImgExpr<ImgBinary<L,R,Op> >
+{
+public:
+	ImgBinary(const L &l, const R &r) : l_(l), r_(r)
+	{
+		assert(l.SizeX() == r.SizeX() && l.SizeY() == r.SizeY());
+	};
+	inline unsigned int SizeX() const { return l_.SizeX(); }
+	inline unsigned int SizeY() const { return l_.SizeY(); }
+	inline double operator[](unsigned int i) const { return Op::Apply(l_[i], r_[i]); }
+
+private:
+	const L l_;
+	const R r_;
+};
+
+/** operation of each taxel of an expression with a scalar */
+template<class L, class Op>
+class ImgScalar : public ImgExpr<ImgScalar<L,Op> >
+{
+public:
+	ImgScalar(const L &l, double v) : l_(l), v_(v) {};
+	inline unsigned int SizeX() const { return l_.SizeX(); }
+	inline unsigned int SizeY() const { return l_.SizeY(); }
+	inline double operator[](unsigned int i) const { return Op::Apply(l_[i], v_); }
+
+private:
+	const L l_;
+	const double v_;
+};
+
+struct ImgAdd { static inline double Apply(double a, double b) { return a + b; } };
+struct ImgSub { static inline double Apply(double a, double b) { return a - b; } };
+struct ImgMul { static inline double Apply(double a, double b) { return a * b; } };
+struct ImgSubFrom { static inline double Apply(double a, double b) { return b - a; } }; // scalar - taxel
+
+
 class DoubleActuatorImg  : public ActuatorImg<double>
 {
 public:
@@ -239,6 +402,56 @@ public:
 
 	DoubleActuatorImg(unsigned int sx, unsigned int sy, double v) : ActuatorImg<double>(sx,sy,v) {};
 
+	DoubleActuatorImg(const DoubleActuatorImg&) = default;
+	DoubleActuatorImg(DoubleActuatorImg&&) = default;
+	DoubleActuatorImg& operator=(const DoubleActuatorImg&) = default;
+	DoubleActuatorImg& operator=(DoubleActuatorImg&&) = default;
+
+	/** evaluate an expression (see ImgExpr) */
+	template<class E>
+	explicit DoubleActuatorImg(const ImgExpr<E> &e) : ActuatorImg<double>(e.SizeX(), e.SizeY())
+	{
+		Assign_(e.Self());
+	};
+
+	template<class E>
+	DoubleActuatorImg& operator=(const ImgExpr<E> &e)
+	{
+		if (Size() != e.Size())
+		{
+			// the expression may read the former taxels
+			DoubleActuatorImg rv(e);
+			*this = std::move(rv);
+			return *this;
+		}
+		sx_ = e.SizeX();
+		sy_ = e.SizeY();
+		Assign_(e.Self());
+		return *this;
+	}
+
+	template<class E>
+	DoubleActuatorImg& operator+=(const ImgExpr<E> &e)
+	{
+		assert(Size() == e.Size());
+		const E &x = e.Self();
+		int n=sx_*sy_;
+		for (int i=0; i<n; ++i)
+			img_[i] += x[i];
+		return *this;
+	}
+
+	template<class E>
+	DoubleActuatorImg& operator-=(const ImgExpr<E> &e)
+	{
+		assert(Size() == e.Size());
+		const E &x = e.Self();
+		int n=sx_*sy_;
+		for (int i=0; i<n; ++i)
+			img_[i] -= x[i];
+		return *this;
+	}
+
 	DoubleActuatorImg* Clone() const
 	{
 		return new DoubleActuatorImg(*this);
@@ -249,14 +462,20 @@ public:
 	 */  
 	virtual ~DoubleActuatorImg() {};
 
-	/** TODO: copied from ActuatorImg */
-	DoubleActuatorImg Mult(double v) const
+	/** TODO: copied from ActuatorImg (see also operator*, which does not copy) */
+	DoubleActuatorImg Mult(double v) const &
 	{
 		DoubleActuatorImg rv = *this;
 		rv.Scale(v);
 		return rv;
 	}
 
+	DoubleActuatorImg Mult(double v) &&
+	{
+		Scale(v);
+		return std::move(*this);
+	}
+
  	DoubleActuatorImg& operator+=(const DoubleActuatorImg &p)
  	{
 		int n=sx_*sy_;
@@ -280,6 +499,15 @@ public:
 			img_[i] -= v;
 		return *this;
 	}
+
+private:
+	template<class E>
+	inline void Assign_(const E &x)
+	{
+		int n=sx_*sy_;
+		for (int i=0; i<n; ++i)
+			img_[i] = x[i];
+	}
 };
 
 
@@ -296,6 +524,21 @@ public:
 
 	RangeImg(unsigned int sx, unsigned int sy, double v) : DoubleActuatorImg(sx,sy,v) {};
 
+	RangeImg(const RangeImg&) = default;
+	RangeImg(RangeImg&&) = default;
+	RangeImg& operator=(const RangeImg&) = default;
+	RangeImg& operator=(RangeImg&&) = default;
+
+	template<class E>
+	explicit RangeImg(const ImgExpr<E> &e) : DoubleActuatorImg(e) {};
+
+	template<class E>
+	RangeImg& operator=(const ImgExpr<E> &e)
+	{
+		DoubleActuatorImg::operator=(e);
+		return *this;
+	}
+
 	RangeImg* Clone() const
 	{
 		return new RangeImg(*this);
@@ -315,6 +558,21 @@ public:
 
 	BiasedImg(unsigned int sx, unsigned int sy, double v) : DoubleActuatorImg(sx,sy,v) {};
 
+	BiasedImg(const BiasedImg&) = default;
+	BiasedImg(BiasedImg&&) = default;
+	BiasedImg& operator=(const BiasedImg&) = default;
+	BiasedImg& operator=(BiasedImg&&) = default;
+
+	template<class X>
+	explicit BiasedImg(const ImgExpr<X> &e) : DoubleActuatorImg(e) {};
+
+	template<class X>
+	BiasedImg& operator=(const ImgExpr<X> &e)
+	{
+		DoubleActuatorImg::operator=(e);
+		return *this;
+	}
+
 	BiasedImg* Clone() const
 	{
 		return new BiasedImg(*this);
@@ -336,4 +594,408 @@ public:
 };
 
 
+
+/**
+ * The StaticActuatorImg class is an ActuatorImg whose size is fixed at compile
+ * time, such as the LATERO_NB_PINS_X x LATERO_NB_PINS_Y frames of the device.
+ * Taxels are stored inline and aligned, and there are no virtual functions, so
+ * that images can live on the stack and loops over them can be unrolled.
+ */
+template<class TTaxel, unsigned int SX, unsigned int SY>
+class StaticActuatorImg
+{
+public:
+
+	/** constructor (taxels are left uninitialized, as in ActuatorImg) */
+	StaticActuatorImg() {};
+
+	/** constructor */
+	explicit StaticActuatorImg(TTaxel v)
+	{
+		Set(v);
+	};
+
+	inline void Set(unsigned int x, unsigned int y, TTaxel v)
+	{
+		Set(GetIndex(x,y), v);
+	};
+
+	inline void Set(TTaxel v)
+	{
+		for (unsigned int i=0; i<Size(); ++i)
+			Set(i, v);
+	};
+
+	inline TTaxel Get(unsigned int x, unsigned int y) const
+	{
+		return Get(GetIndex(x,y));
+	};
+
+	inline void Set(unsigned int i, TTaxel v)
+	{
+		img_[i] = v;
+	};
+
+	inline TTaxel Get(unsigned int i) const
+	{
+		return img_[i];
+	};
+
+	static constexpr unsigned int Size()
+	{
+		return SX*SY;
+	};
+
+	static constexpr unsigned int SizeX()
+	{
+		return SX;
+	};
+
+	static constexpr unsigned int SizeY()
+	{
+		return SY;
+	};
+
+	/** @return taxel values, in the order of the linear positions */
+	inline TTaxel* Data()
+	{
+		return img_.data();
+	};
+
+	inline const TTaxel* Data() const
+	{
+		return img_.data();
+	};
+
+	inline std::vector<TTaxel> Vector() const
+	{
+		return std::vector<TTaxel>(img_.begin(), img_.end());
+	}
+
+	inline void Scale(TTaxel v)
+	{
+		for (unsigned int i=0; i<Size(); ++i)
+			Set(i, v*Get(i));
+	}
+
+	StaticActuatorImg Mult(TTaxel v) const
+	{
+		StaticActuatorImg rv = *this;
+		rv.Scale(v);
+		return rv;
+	}
+
+	/** copy the taxels of an image of the same size */
+	void CopyFrom(const ActuatorImg<TTaxel> &src)
+	{
+		assert(src.SizeX() == SX && src.SizeY() == SY);
+		for (unsigned int i=0; i<Size(); ++i)
+			img_[i] = src.Get(i);
+	}
+
+	/** copy the taxels to an image of the same size */
+	void CopyTo(ActuatorImg<TTaxel> &dest) const
+	{
+		assert(dest.SizeX() == SX && dest.SizeY() == SY);
+		for (unsigned int i=0; i<Size(); ++i)
+			dest.Set(i, img_[i]);
+	}
+
+protected:
+
+	inline unsigned int GetIndex(unsigned int x, unsigned int y) const
+	{
+		assert(x<SX);
+		assert(y<SY);
+		return y*SX + x;
+	};
+
+	/**
+	 * taxel values, aligned for vector loads
+	 */
+	alignas(32) std::array<TTaxel, SX*SY> img_;
+};
+
+
+/**
+ * How a taxel type encodes values of the range of motion (-1.0 to 1.0, see
+ * RangeImg). Floating point types hold the value itself. Integer types are
+ * fixed point, and saturate: int16_t is Q15 (-32768 is -1.0, 32767 just under
+ * 1.0) and uint8_t is offset (0 is -1.0, 255 is 1.0).
+ */
+template<class T>
+struct RangeEncoding
+{
+	static inline double Decode(T v) { return v; }
+	static inline T Encode(double x) { return static_cast<T>(x); }
+};
+
+template<>
+struct RangeEncoding<int16_t>
+{
+	static inline double Decode(int16_t v) { return v / 32768.0; }
+	static inline int16_t Encode(double x)
+	{
+		x = std::round(x * 32768.0);
+		return static_cast<int16_t>(x > -32768.0 ? (x < 32767.0 ? x : 32767.0) : -32768.0); // NaN: -1.0
+	}
+};
+
+template<>
+struct RangeEncoding<uint8_t>
+{
+	static inline double Decode(uint8_t v) { return v / 127.5 - 1.0; }
+	static inline uint8_t Encode(double x)
+	{
+		x = std::round((x + 1.0) * 127.5);
+		return static_cast<uint8_t>(x > 0.0 ? (x < 255.0 ? x : 255.0) : 0.0); // NaN: -1.0
+	}
+};
+
+
+/**
+ * StaticActuatorImg with the arithmetic of DoubleActuatorImg, applied to the
+ * values the taxels encode (see RangeEncoding).
+ */
+template<class TTaxel, unsigned int SX, unsigned int SY>
+class StaticArithmeticImg : public StaticActuatorImg<TTaxel,SX,SY>
+{
+	typedef RangeEncoding<TTaxel> E;
+
+public:
+	StaticArithmeticImg() {};
+
+	explicit StaticArithmeticImg(TTaxel v) : StaticActuatorImg<TTaxel,SX,SY>(v) {};
+
+	/** evaluate an expression (see ImgExpr), encoding its values */
+	template<class X>
+	StaticArithmeticImg(const ImgExpr<X> &e)
+	{
+		*this = e;
+	};
+
+	template<class X>
+	StaticArithmeticImg& operator=(const ImgExpr<X> &e)
+	{
+		assert(e.SizeX() == SX && e.SizeY() == SY);
+		const X &x = e.Self();
+		for (unsigned int i=0; i<SX*SY; ++i)
+			this->img_[i] = E::Encode(x[i]);
+		return *this;
+	}
+
+	template<class X>
+	StaticArithmeticImg& operator+=(const ImgExpr<X> &e)
+	{
+		assert(e.SizeX() == SX && e.SizeY() == SY);
+		const X &x = e.Self();
+		for (unsigned int i=0; i<SX*SY; ++i)
+			this->img_[i] = E::Encode(E::Decode(this->img_[i]) + x[i]);
+		return *this;
+	}
+
+	template<class X>
+	StaticArithmeticImg& operator-=(const ImgExpr<X> &e)
+	{
+		assert(e.SizeX() == SX && e.SizeY() == SY);
+		const X &x = e.Self();
+		for (unsigned int i=0; i<SX*SY; ++i)
+			this->img_[i] = E::Encode(E::Decode(this->img_[i]) - x[i]);
+		return *this;
+	}
+
+	StaticArithmeticImg& operator+=(const StaticArithmeticImg &p)
+	{
+		for (unsigned int i=0; i<SX*SY; ++i)
+			this->img_[i] = E::Encode(E::Decode(this->img_[i]) + E::Decode(p.img_[i]));
+		return *this;
+	}
+
+	StaticArithmeticImg& operator-=(const StaticArithmeticImg &p)
+	{
+		for (unsigned int i=0; i<SX*SY; ++i)
+			this->img_[i] = E::Encode(E::Decode(this->img_[i]) - E::Decode(p.img_[i]));
+		return *this;
+	}
+
+	StaticArithmeticImg& operator-=(double v)
+	{
+		for (unsigned int i=0; i<SX*SY; ++i)
+			this->img_[i] = E::Encode(E::Decode(this->img_[i]) - v);
+		return *this;
+	}
+
+	inline void Scale(double v)
+	{
+		for (unsigned int i=0; i<SX*SY; ++i)
+			this->img_[i] = E::Encode(v * E::Decode(this->img_[i]));
+	}
+
+	StaticArithmeticImg Mult(double v) const
+	{
+		StaticArithmeticImg rv = *this;
+		rv.Scale(v);
+		return rv;
+	}
+
+	/** set the taxels to the values of an image of another taxel type */
+	template<class U>
+	void ConvertFrom(const StaticArithmeticImg<U,SX,SY> &src)
+	{
+		for (unsigned int i=0; i<SX*SY; ++i)
+			this->img_[i] = E::Encode(RangeEncoding<U>::Decode(src.Get(i)));
+	}
+};
+
+template<unsigned int SX, unsigned int SY>
+using StaticDoubleActuatorImg = StaticArithmeticImg<double,SX,SY>;
+
+
+/**
+ * RangeImg of a size fixed at compile time (see StaticActuatorImg), with
+ * taxels of type double, float, int16_t or uint8_t (see RangeEncoding).
+ */
+template<unsigned int SX, unsigned int SY, class TTaxel = double>
+class StaticRangeImg : public StaticArithmeticImg<TTaxel,SX,SY>
+{
+public:
+	StaticRangeImg() {};
+
+	explicit StaticRangeImg(TTaxel v) : StaticArithmeticImg<TTaxel,SX,SY>(v) {};
+
+	template<class X>
+	StaticRangeImg(const ImgExpr<X> &e) : StaticArithmeticImg<TTaxel,SX,SY>(e) {};
+
+	template<class X>
+	StaticRangeImg& operator=(const ImgExpr<X> &e)
+	{
+		StaticArithmeticImg<TTaxel,SX,SY>::operator=(e);
+		return *this;
+	}
+};
+
+
+/**
+ * BiasedImg of a size fixed at compile time (see StaticActuatorImg).
+ */
+template<unsigned int SX, unsigned int SY>
+class StaticBiasedImg : public StaticDoubleActuatorImg<SX,SY>
+{
+public:
+	StaticBiasedImg() {};
+
+	explicit StaticBiasedImg(double v) : StaticDoubleActuatorImg<SX,SY>(v) {};
+
+	template<class X>
+	StaticBiasedImg(const ImgExpr<X> &e) : StaticDoubleActuatorImg<SX,SY>(e) {};
+
+	template<class X>
+	StaticBiasedImg& operator=(const ImgExpr<X> &e)
+	{
+		StaticDoubleActuatorImg<SX,SY>::operator=(e);
+		return *this;
+	}
+
+	void ConvertToRange(StaticRangeImg<SX,SY> &dest) const
+	{
+		for (unsigned int i=0; i<SX*SY; ++i)
+			dest.Set(i, 1.0 - 2.0*this->img_[i]);
+	};
+
+	void ConvertFromRange(const StaticRangeImg<SX,SY> &src)
+	{
+		for (unsigned int i=0; i<SX*SY; ++i)
+			this->img_[i] = 0.5 * (1.0 - src.Get(i));
+	};
+};
+
+
+
+/*
+ * Operators of image expressions (see ImgExpr). ImgOperand() gives the node of
+ * each kind of operand; operators are only defined for operands that have one.
+ */
+
+inline ImgLeaf<double> ImgOperand(const ActuatorImg<double> &img)
+{
+	return ImgLeaf<double>(img.Data(), img.SizeX(), img.SizeY());
+}
+
+template<class TTaxel, unsigned int SX, unsigned int SY>
+inline ImgLeaf<TTaxel> ImgOperand(const StaticArithmeticImg<TTaxel,SX,SY> &img)
+{
+	return ImgLeaf<TTaxel>(img.Data(), SX, SY);
+}
+
+template<class E>
+inline const E& ImgOperand(const ImgExpr<E> &e)
+{
+	return e.Self();
+}
+
+template<class A>
+using ImgNode = typename std::decay<decltype(ImgOperand(std::declval<const A&>()))>::type;
+
+template<class A, class B>
+inline ImgBinary<ImgNode<A>, ImgNode<B>, ImgAdd> operator+(const A &a, const B &b)
+{
+	return ImgBinary<ImgNode<A>, ImgNode<B>, ImgAdd>(ImgOperand(a), ImgOperand(b));
+}
+
+template<class A, class B>
+inline ImgBinary<ImgNode<A>, ImgNode<B>, ImgSub> operator-(const A &a, const B &b)
+{
+	return ImgBinary<ImgNode<A>, ImgNode<B>, ImgSub>(ImgOperand(a), ImgOperand(b));
+}
+
+/** taxel by taxel product */
+template<class A, class B>
+inline ImgBinary<ImgNode<A>, ImgNode<B>, ImgMul> operator*(const A &a, const B &b)
+{
+	return ImgBinary<ImgNode<A>, ImgNode<B>, ImgMul>(ImgOperand(a), ImgOperand(b));
+}
+
+template<class A>
+inline ImgScalar<ImgNode<A>, ImgMul> operator*(const A &a, double v)
+{
+	return ImgScalar<ImgNode<A>, ImgMul>(ImgOperand(a), v);
+}
+
+template<class A>
+inline ImgScalar<ImgNode<A>, ImgMul> operator*(double v, const A &a)
+{
+	return ImgScalar<ImgNode<A>, ImgMul>(ImgOperand(a), v);
+}
+
+template<class A>
+inline ImgScalar<ImgNode<A>, ImgAdd> operator+(const A &a, double v)
+{
+	return ImgScalar<ImgNode<A>, ImgAdd>(ImgOperand(a), v);
+}
+
+template<class A>
+inline ImgScalar<ImgNode<A>, ImgAdd> operator+(double v, const A &a)
+{
+	return ImgScalar<ImgNode<A>, ImgAdd>(ImgOperand(a), v);
+}
+
+template<class A>
+inline ImgScalar<ImgNode<A>, ImgSub> operator-(const A &a, double v)
+{
+	return ImgScalar<ImgNode<A>, ImgSub>(ImgOperand(a), v);
+}
+
+template<class A>
+inline ImgScalar<ImgNode<A>, ImgSubFrom> operator-(double v, const A &a)
+{
+	return ImgScalar<ImgNode<A>, ImgSubFrom>(ImgOperand(a), v);
+}
+
+template<class A>
+inline ImgScalar<ImgNode<A>, ImgMul> operator-(const A &a)
+{
+	return ImgScalar<ImgNode<A>, ImgMul>(ImgOperand(a), -1.0);
+}
+
+
 };
@@ -1,10 +1,12 @@
 #include "tactograph.h"
+#include "tl-latero/latero_log.h"
 #include <math.h>
 #include <iostream>
 
 namespace latero {
 
-Tactograph::Tactograph() :
+Tactograph::Tactograph(const char *address) :
+	TactileDisplay(address),
 	workspaceWidth_(WORKSPACE_WIDTH),
 	workspaceHeight_(WORKSPACE_HEIGHT),
     emPos_(0,0), emOrientation_(0)
@@ -16,11 +18,11 @@ Tactograph::Tactograph() :
 	{
 	  // reset position...
 	  latero_pkt_t response;
-	  latero_write(handle_, &response);
+	  latero_poll(handle_, &response);
 	  if ((response.hdr.type == PKT_TYPE_FULLR0) || (response.hdr.type == PKT_TYPE_FULLR1))
 	  {
 	      if (response.fullr.iostatus == 0x0000) 
-		 std::cout << "Warning !! The LateroIO status is invalid.\n The Latero I/O interface\nis likely to be unplugged or not powered on.\n";
+		 latero_log(LATERO_LOG_WARNING, "The LateroIO status is invalid. The Latero I/O interface is likely to be unplugged or not powered on.");
 	      else 
                 latero_reset_position(handle_, response.fullr.quad);
 	  }
@@ -47,9 +49,7 @@ void Tactograph::ReadCarrierState(Point &position, double &orientation)
 	else
 	{
 		double pos[2]; // position within pantograph workspace
-		pos[0] = x_;
-		pos[1] = y_;
-		orientation = theta_;
+		GetCarrierPose(pos[0], pos[1], orientation);
 
 		// clip to workspace (todo)
 		pos[0] = fmin(fmax(pos[0],0.0),workspaceWidth_);
@@ -11,7 +11,11 @@ namespace latero {
 class Tactograph : public TactileDisplay
 {
 public:
-	Tactograph();
+	/**
+	 * constructor
+	 * @param address IP address of the Latero (e.g. 127.0.0.1 for the latero-sim simulator)
+	 */
+	Tactograph(const char *address = LATERO_DEFAULT_IP);
 	virtual ~Tactograph();
 
 	/** 
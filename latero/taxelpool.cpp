@@ -0,0 +1,219 @@
+#include "taxelpool.h"
+#include <stdint.h>
+#include <new>
+
+namespace latero {
+
+// number of distinct buffer sizes cached by a thread
+static const int NB_CACHED_SIZES = 16;
+
+enum BufferOrigin { FROM_HEAP, FROM_ARENA };
+
+/** header placed before each buffer, which keeps buffers aligned on 16 bytes */
+struct alignas(16) BufferHeader
+{
+	BufferHeader *next; // next buffer of the free list, while cached
+	uint32_t origin;    // BufferOrigin
+	uint32_t size;      // bytes, including the header
+};
+
+/**
+ * buffers freed by a thread, and its statistics; zero-initialized and trivially
+ * destructible, so that images destroyed after the thread cache still find it
+ */
+struct ThreadCache
+{
+	struct FreeList
+	{
+		uint32_t size; // bytes of the buffers, including the header, 0 if the list is unused
+		unsigned int count;
+		BufferHeader *head;
+	};
+
+	bool enabled;
+	FreeList lists[NB_CACHED_SIZES];
+	TaxelArena *arena; // arena of the current scope, if any
+	TaxelStats stats;
+
+	/** @return list of buffers of a size, NULL if there are already too many sizes */
+	FreeList *List(uint32_t size)
+	{
+		for (int i=0; i<NB_CACHED_SIZES; ++i)
+		{
+			if (lists[i].size == size)
+				return &lists[i];
+			if (lists[i].size == 0)
+			{
+				lists[i].size = size;
+				return &lists[i];
+			}
+		}
+		return NULL;
+	}
+
+	void Release()
+	{
+		for (int i=0; i<NB_CACHED_SIZES; ++i)
+		{
+			while (BufferHeader *h = lists[i].head)
+			{
+				lists[i].head = h->next;
+				::operator delete(h);
+			}
+			lists[i] = FreeList();
+		}
+		stats.cachedBytes = 0;
+	}
+};
+
+static thread_local ThreadCache cache;
+
+/** releases the cache of a thread when it exits */
+struct CacheReleaser
+{
+	~CacheReleaser()
+	{
+		cache.enabled = false;
+		cache.Release();
+	}
+};
+
+
+void *TaxelPool::Allocate(size_t bytes, bool fromArena)
+{
+	ThreadCache &tc = cache;
+	size_t size = (bytes + 2*sizeof(BufferHeader) - 1) & ~(sizeof(BufferHeader) - 1);
+	BufferHeader *h = NULL;
+	tc.stats.allocations++;
+
+	if (tc.arena && fromArena)
+	{
+		h = static_cast<BufferHeader*>(tc.arena->Allocate_(size));
+		if (h)
+		{
+			h->origin = FROM_ARENA;
+			tc.stats.arenaAllocations++;
+			return h + 1;
+		}
+		tc.stats.arenaOverflows++;
+	}
+
+	if (tc.enabled && size <= MAX_CACHED_SIZE)
+	{
+		ThreadCache::FreeList *list = tc.List(size);
+		if (list && list->head)
+		{
+			h = list->head;
+			list->head = h->next;
+			list->count--;
+			tc.stats.cacheReuses++;
+			tc.stats.cachedBytes -= size;
+			return h + 1;
+		}
+	}
+
+	h = static_cast<BufferHeader*>(::operator new(size));
+	h->origin = FROM_HEAP;
+	h->size = size;
+	tc.stats.heapAllocations++;
+	return h + 1;
+}
+
+void TaxelPool::Free(void *buffer)
+{
+	if (!buffer)
+		return;
+	ThreadCache &tc = cache;
+	BufferHeader *h = static_cast<BufferHeader*>(buffer) - 1;
+	tc.stats.frees++;
+
+	// arena buffers are reclaimed by TaxelArena::Reset()
+	if (h->origin == FROM_ARENA)
+		return;
+
+	if (tc.enabled && h->size <= MAX_CACHED_SIZE)
+	{
+		ThreadCache::FreeList *list = tc.List(h->size);
+		if (list && list->count < MAX_CACHED_BUFFERS)
+		{
+			h->next = list->head;
+			list->head = h;
+			list->count++;
+			tc.stats.cachedBytes += h->size;
+			return;
+		}
+	}
+	::operator delete(h);
+}
+
+bool TaxelPool::IsFromArena(const void *buffer)
+{
+	return buffer && (static_cast<const BufferHeader*>(buffer) - 1)->origin == FROM_ARENA;
+}
+
+void TaxelPool::EnableThreadCache(bool enable)
+{
+	static thread_local CacheReleaser releaser;
+	(void) releaser;
+	cache.enabled = enable;
+	if (!enable)
+		cache.Release();
+}
+
+bool TaxelPool::IsThreadCacheEnabled()
+{
+	return cache.enabled;
+}
+
+void TaxelPool::ReleaseThreadCache()
+{
+	cache.Release();
+}
+
+TaxelStats TaxelPool::GetStats()
+{
+	return cache.stats;
+}
+
+void TaxelPool::ResetStats()
+{
+	size_t cachedBytes = cache.stats.cachedBytes;
+	cache.stats = TaxelStats();
+	cache.stats.cachedBytes = cachedBytes;
+}
+
+
+TaxelArena::Scope::Scope(TaxelArena &arena) :
+	previous_(cache.arena)
+{
+	cache.arena = &arena;
+}
+
+TaxelArena::Scope::~Scope()
+{
+	cache.arena = previous_;
+}
+
+TaxelArena::TaxelArena(size_t capacity) :
+	memory_(static_cast<char*>(::operator new(capacity))),
+	capacity_(capacity), used_(0), peak_(0)
+{
+}
+
+TaxelArena::~TaxelArena()
+{
+	::operator delete(memory_);
+}
+
+void *TaxelArena::Allocate_(size_t bytes)
+{
+	if (bytes > capacity_ - used_)
+		return NULL;
+	void *p = memory_ + used_;
+	used_ += bytes;
+	if (used_ > peak_)
+		peak_ = used_;
+	return p;
+}
+
+}; // latero
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stddef.h>
+
+namespace latero {
+
+/** Allocations of taxel buffers made by a thread (see TaxelPool). */
+struct TaxelStats
+{
+	unsigned long allocations;      // buffers allocated
+	unsigned long frees;            // buffers freed
+	unsigned long heapAllocations;  // buffers taken from the heap
+	unsigned long cacheReuses;      // buffers taken from the thread cache
+	unsigned long arenaAllocations; // buffers taken from an arena
+	unsigned long arenaOverflows;   // buffers taken elsewhere because the arena was full
+	size_t cachedBytes;             // bytes held by the thread cache
+};
+
+/**
+ * Allocator of the taxel buffers of ActuatorImg. By default buffers come from
+ * the heap. A thread can keep the buffers it frees in a cache, with a free list
+ * for each size class, and reuse them for its next images rather than going
+ * back to the heap; or it can take buffers from a TaxelArena. Buffers can be
+ * freed by any thread, whichever way they were allocated.
+ */
+class TaxelPool
+{
+public:
+	/** largest buffer kept by the thread cache [bytes] */
+	static const size_t MAX_CACHED_SIZE = 64*1024;
+
+	/** largest number of buffers kept by the thread cache in each size class */
+	static const unsigned int MAX_CACHED_BUFFERS = 64;
+
+	/**
+	 * @return buffer of at least bytes, aligned for any taxel type
+	 * @param fromArena false to bypass the TaxelArena of the calling thread, if any
+	 */
+	static void *Allocate(size_t bytes, bool fromArena = true);
+
+	/** free a buffer returned by Allocate(), NULL is ignored */
+	static void Free(void *buffer);
+
+	/** @return true if a buffer returned by Allocate() belongs to a TaxelArena */
+	static bool IsFromArena(const void *buffer);
+
+	/**
+	 * Keep the buffers freed by the calling thread for its next allocations.
+	 * Disabling the cache releases the buffers it holds.
+	 */
+	static void EnableThreadCache(bool enable);
+
+	/** @return true if the calling thread caches its buffers */
+	static bool IsThreadCacheEnabled();
+
+	/** return the buffers held by the cache of the calling thread to the heap */
+	static void ReleaseThreadCache();
+
+	/** @return allocations made by the calling thread since it started or called ResetStats() */
+	static TaxelStats GetStats();
+
+	/** restart the statistics of the calling thread */
+	static void ResetStats();
+};
+
+/**
+ * Memory from which the images built during a tick are allocated by bumping a
+ * pointer, and which is reclaimed at once with Reset(). While a Scope is alive,
+ * the taxel buffers allocated by its thread come from the arena; freeing them
+ * does nothing. Images allocated from the arena must be destroyed before it
+ * is reset, or copied into images allocated elsewhere. Moving an image whose
+ * taxels are in an arena copies them: an image assigned them keeps a buffer
+ * from where its own came from, and an image constructed from them is
+ * allocated like any other. When the arena is full, buffers come from the
+ * heap (or the thread cache) instead.
+ */
+class TaxelArena
+{
+public:
+	/** Makes an arena the source of the buffers of the current thread, until destroyed. */
+	class Scope
+	{
+	public:
+		Scope(TaxelArena &arena);
+		~Scope();
+
+	private:
+		Scope(const Scope&);
+		Scope& operator=(const Scope&);
+
+		TaxelArena *previous_;
+	};
+
+	/**
+	 * constructor
+	 * @param capacity bytes of the arena, allocated once
+	 */
+	TaxelArena(size_t capacity);
+	~TaxelArena();
+
+	/** reclaim all the buffers allocated from the arena */
+	inline void Reset() { used_ = 0; }
+
+	/** @return bytes allocated since the last Reset() */
+	inline size_t GetUsed() const { return used_; }
+
+	/** @return most bytes allocated between two calls to Reset() */
+	inline size_t GetPeak() const { return peak_; }
+
+	inline size_t GetCapacity() const { return capacity_; }
+
+private:
+	friend class TaxelPool;
+
+	/** @return bytes of memory, NULL if the arena is full */
+	void *Allocate_(size_t bytes);
+
+	TaxelArena(const TaxelArena&);
+	TaxelArena& operator=(const TaxelArena&);
+
+	char *memory_;
+	size_t capacity_;
+	size_t used_, peak_;
+};
+
+}; // latero
@@ -1,3 +1,7 @@
+#ifdef __linux__
+#define _GNU_SOURCE // ppoll()
+#endif
+
 #include <string.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
@@ -8,9 +12,18 @@
 #include <sys/types.h>
 #include <assert.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
 
 #include "latero_io.h"
 #include "latero.h"
+#include "latero_uring.h"
+#include "latero_capture.h"
+#include "latero_quantize.h"
+#include "latero_calib.h"
+#include "latero_log.h"
 
 #define TIMEOUTS_ENABLED
 
@@ -19,6 +32,16 @@
 #define L1 245.6
 #define L2 62.7
 
+// busy polling time requested from the network stack in LATERO_WAIT_BUSY_POLL [us]
+#define BUSY_POLL_US 50
+
+// bounds of the response timeout derived from the round-trip time [us]
+#define RTT_MIN_TIMEOUT_US 200
+#define RTT_MAX_TIMEOUT_US 5000
+
+// weight of the round-trip time variation in the response timeout
+#define RTT_K 4
+
 // offset of root relative to full workspace
 #define ROOT_OFFSET_X 11.1
 #define ROOT_OFFSET_Y -61.2
@@ -62,7 +85,7 @@ int readDIODir( latero_t* latero, uint16_t *value)
 }
 
 
-int socketIsReadable( int sock_desc, int ms_timeout ) {
+int socketIsReadable( int sock_desc, int us_timeout ) {
 
     fd_set socketReadSet;
 
@@ -71,16 +94,16 @@ int socketIsReadable( int sock_desc, int ms_timeout ) {
 
     struct timeval timeout;
 
-    if ( ms_timeout > 0 ) {
-        timeout.tv_sec  =  ms_timeout / 1000;
-        timeout.tv_usec = (ms_timeout % 1000) * 1000;
+    if ( us_timeout > 0 ) {
+        timeout.tv_sec  =  us_timeout / 1000000;
+        timeout.tv_usec =  us_timeout % 1000000;
     } else {
         timeout.tv_sec  = 0;
         timeout.tv_usec = 0;
     }
 
     if ( select(sock_desc+1,&socketReadSet,0,0,&timeout ) < 0 ) {
-        fprintf(stderr,"Socket Error on select()");
+        LATERO_LOG_EVERY(1000, LATERO_LOG_ERROR, "select() failed: %s", strerror(errno));
         return 0;
     }
     return ( FD_ISSET(sock_desc,&socketReadSet) != 0 );
@@ -98,38 +121,480 @@ void raw_cmd_packet(uint8_t command, uint16_t addr, uint16_t data, latero_pkt_t*
 }
 
 
-int exchange_packet(latero_t* latero, latero_pkt_t* to_send, latero_pkt_t* response)
+/** @return monotonic time [ns] */
+int64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/** @return monotonic time [us] */
+int64_t monotonic_us(void)
+{
+    return monotonic_ns() / 1000;
+}
+
+
+ssize_t send_datagram(latero_t* latero, const char* buf, size_t len)
+{
+  if (latero->transport == LATERO_TRANSPORT_URING)
+    return latero_uring_send( latero, buf, len );
+  if (latero->transport == LATERO_TRANSPORT_REPLAY)
+    return latero_replay_send( latero, buf, len );
+  if (latero->wait_strategy == LATERO_WAIT_SELECT)
+    return sendto( latero->udp_socket, buf, len, 0,
+                   (struct sockaddr*) &latero->si_server,
+                   sizeof(struct sockaddr) );
+  return send( latero->udp_socket, buf, len, 0 );
+}
+
+
+/**
+ * Read a datagram from the socket into rspbuff, recording when it was read and,
+ * if the kernel time-stamped it (SO_TIMESTAMPNS), when it was received.
+ * @param flags  as for recv()
+ * @return as for recv()
+ */
+ssize_t recv_stamped(latero_t* latero, int flags)
 {
   ssize_t numbytes;
-  struct sockaddr si_other;
-  socklen_t slen = sizeof(si_other);
-
-  packPacket( latero->pktbuff, BUFLEN, to_send );
-  numbytes = sendto( latero->udp_socket, latero->pktbuff, BUFLEN, 0,
-                     (struct sockaddr*) &latero->si_server,
-                     sizeof(struct sockaddr) );
-  if (numbytes < 0 ) {
-    fprintf(stderr,"Packet sending error!\n");
+  struct msghdr msg;
+  struct iovec iov;
+  union {
+    char buf[CMSG_SPACE(sizeof(struct timespec))];
+    struct cmsghdr align;
+  } control;
+
+  iov.iov_base = latero->rspbuff;
+  iov.iov_len = BUFLEN;
+  memset( &msg, 0, sizeof(msg) );
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  numbytes = recvmsg( latero->udp_socket, &msg, flags );
+  if ( numbytes < 0 )
+    return(numbytes);
+  latero->rx_wake_ns = monotonic_ns();
+  latero->rx_kernel_ns = 0;
+
+#ifdef SO_TIMESTAMPNS
+  {
+    struct cmsghdr* cmsg;
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+        /* the timestamp is on the real-time clock: take it back to monotonic time */
+        struct timespec stamp, now;
+        int64_t age;
+        memcpy( &stamp, CMSG_DATA(cmsg), sizeof(stamp) );
+        clock_gettime( CLOCK_REALTIME, &now );
+        age = (int64_t)(now.tv_sec - stamp.tv_sec) * 1000000000 + (now.tv_nsec - stamp.tv_nsec);
+        latero->rx_kernel_ns = latero->rx_wake_ns - (age > 0 ? age : 0);
+        break;
+      }
+    }
+  }
+#endif
+  return(numbytes);
+}
+
+
+/**
+ * Receive a datagram into rspbuff, waiting according to the wait strategy.
+ * @param us_timeout  timeout [us], 0 to return immediately, negative to wait forever
+ * @return number of bytes received, 0 on timeout, -1 on error
+ */
+ssize_t recv_datagram(latero_t* latero, int us_timeout)
+{
+  ssize_t numbytes;
+  int sock = latero->udp_socket;
+
+  if (latero->transport != LATERO_TRANSPORT_SOCKET) {
+    /* these backends do not report when the kernel received the datagram */
+    if (latero->transport == LATERO_TRANSPORT_REPLAY)
+      numbytes = latero_replay_recv( latero, us_timeout );
+    else
+      numbytes = latero_uring_recv( latero, us_timeout );
+    if ( numbytes < 0 )
+      LATERO_LOG_EVERY(1000, LATERO_LOG_ERROR, "Error receiving response: %s", strerror(errno));
+    if ( numbytes > 0 ) {
+      latero->rx_wake_ns = monotonic_ns();
+      latero->rx_kernel_ns = 0;
+    }
+    return(numbytes);
+  }
+
+  switch (latero->wait_strategy) {
+    case LATERO_WAIT_SELECT:
+      if ( us_timeout >= 0 && !socketIsReadable( sock, us_timeout ) )
+        return(0);
+      numbytes = recv_stamped( latero, 0 );
+      break;
+
+    case LATERO_WAIT_CONNECTED: {
+      struct pollfd pfd;
+      struct timespec ts;
+      int ready;
+      pfd.fd = sock;
+      pfd.events = POLLIN;
+#ifdef __linux__
+      ts.tv_sec = us_timeout / 1000000;
+      ts.tv_nsec = (long)(us_timeout % 1000000) * 1000;
+      ready = ppoll( &pfd, 1, us_timeout < 0 ? NULL : &ts, NULL );
+#else
+      (void) ts;
+      ready = poll( &pfd, 1, us_timeout < 0 ? -1 : (us_timeout + 999) / 1000 );
+#endif
+      if ( ready == 0 )
+        return(0);
+      /* errors are reported below, as those of recv() */
+      numbytes = ready < 0 ? -1 : recv_stamped( latero, 0 );
+      break;
+    }
+
+    case LATERO_WAIT_BLOCKING:
+      if ( us_timeout == 0 ) {
+        numbytes = recv_stamped( latero, MSG_DONTWAIT );
+      } else {
+        if ( us_timeout != latero->rcvtimeo_us ) {
+          struct timeval tv;
+          tv.tv_sec = us_timeout > 0 ? us_timeout / 1000000 : 0;
+          tv.tv_usec = us_timeout > 0 ? us_timeout % 1000000 : 0;
+          setsockopt( sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv) );
+          latero->rcvtimeo_us = us_timeout;
+        }
+        numbytes = recv_stamped( latero, 0 );
+      }
+      break;
+
+    case LATERO_WAIT_BUSY_POLL: {
+      int64_t deadline = monotonic_us() + us_timeout;
+      do {
+        numbytes = recv_stamped( latero, 0 );
+      } while ( numbytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)
+                && (us_timeout < 0 || monotonic_us() < deadline) );
+      break;
+    }
+
+    default:
+      return(-1);
+  }
+
+  if ( numbytes < 0 ) {
+    if ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR )
+      return(0);
+    LATERO_LOG_EVERY(1000, LATERO_LOG_ERROR, "Error receiving response: %s", strerror(errno));
     return(-1);
   }
+  return(numbytes);
+}
+
+
+/** Store a 16-bit value in network byte order at buf[offset]. */
+void patch_U16(char* buf, unsigned int offset, uint16_t value)
+{
+  uint16_t tmp = htons(value);
+  memcpy( &buf[offset], &tmp, sizeof(tmp) );
+}
+
+
+/**
+ * Stamp the next sequence number into an encoded request.
+ * @return sequence number of the request
+ */
+uint16_t stamp_seq(latero_t* latero, char* buf)
+{
+  uint16_t seq = latero->seq++;
+  patch_U16( buf, LATERO_SEQ_OFFSET, seq );
+  return seq;
+}
+
+
+/**
+ * Stamp and send an encoded request.
+ * @return sequence number of the request, -1 on error
+ */
+int send_request(latero_t* latero, char* buf, int len)
+{
+  uint16_t seq = stamp_seq( latero, buf );
+
+  if ( send_datagram( latero, buf, len ) < 0 ) {
+    LATERO_LOG_EVERY(1000, LATERO_LOG_ERROR, "Packet sending error: %s", strerror(errno));
+    return(-1);
+  }
+  latero_capture_packet( latero, LATERO_CAPTURE_TX, buf, len );
+  return(seq);
+}
+
+
+/** @return timeout for a response [us], negative to wait forever */
+int response_timeout(latero_t* latero)
+{
 #ifdef TIMEOUTS_ENABLED
-  if( socketIsReadable( latero->udp_socket, 5 ) ) {
+  return(latero->stats.timeout_us);
+#else
+  (void) latero;
+  return(-1);
 #endif
-    numbytes = recvfrom( latero->udp_socket, &latero->rspbuff, BUFLEN, 0,
-                         (struct sockaddr*) &si_other, &slen );
+}
+
+
+/**
+ * Back off after a request timed out, in case the round-trip time went up.
+ * The estimate takes over again with the next response.
+ */
+void rtt_timeout(latero_t* latero)
+{
+  LATERO_LOG_EVERY(5000, LATERO_LOG_WARNING,
+                   "No response from the Latero within %d us (check the IP address and that the server is running on the Latero)",
+                   latero->stats.timeout_us);
+  latero->stats.timeouts++;
+  latero->stats.timeout_us *= 2;
+  if (latero->stats.timeout_us > RTT_MAX_TIMEOUT_US)
+    latero->stats.timeout_us = RTT_MAX_TIMEOUT_US;
+}
+
+
+/**
+ * Wait for a valid Latero packet.
+ * @param deadline  monotonic time [us] at which to give up, 0 to return
+ *                  immediately, negative to wait forever
+ * @return 1 if a packet was received, 0 on timeout, -1 on error
+ */
+int receive_packet(latero_t* latero, int64_t deadline, latero_pkt_t* response)
+{
+  ssize_t numbytes;
+  int64_t left;
+
+  while (1) {
+    left = deadline;
+    if (deadline > 0) {
+      left = deadline - monotonic_us();
+      if (left < 0)
+        left = 0;
+    }
+    numbytes = recv_datagram( latero, (int) left );
+    if ( numbytes <= 0 )
+      return(numbytes < 0 ? -1 : 0);
+    latero_capture_packet( latero, LATERO_CAPTURE_RX, latero->rspbuff, numbytes );
+    if ( unpackPacket( latero->rspbuff, numbytes, response ) == 0 )
+      return(1);
+    latero->stats.invalid++;
+  }
+}
+
+
+/**
+ * Record the timing of the response last received, to the request sent at
+ * time sent [ns], and update the round-trip time estimate with it.
+ */
+void time_response(latero_t* latero, int64_t sent)
+{
+  latero->timing.sent_ns = sent;
+  latero->timing.kernel_rx_ns = latero->rx_kernel_ns;
+  latero->timing.wake_ns = latero->rx_wake_ns;
+  latero_update_rtt( latero, (latero->rx_wake_ns - sent) / 1000 );
+}
+
+
+/**
+ * Check whether a response answers the request with sequence number seq, sent
+ * at time sent [ns], and time it if it does.
+ * @return 1 if it does, 0 if it is a late response to an earlier request
+ */
+int match_response(latero_t* latero, const latero_pkt_t* response, uint16_t seq, int64_t sent)
+{
+  /* sequence numbers can only be relied upon once the Latero is seen echoing them */
+  if (response->hdr.seq != seq && latero->seq_echo) {
+    latero->stats.stale++;
+    return(0);
+  }
+  if (response->hdr.seq == seq && seq != 0)
+    latero->seq_echo = 1;
+  latero->stats.responses++;
+  time_response( latero, sent );
+  return(1);
+}
+
+
+/**
+ * Retire the request in flight with sequence number seq, along with any older
+ * request (whose response is presumed lost).
+ * @return 1 if seq was in flight, 0 otherwise (stale or duplicate response)
+ */
+int retire_inflight(latero_t* latero, uint16_t seq)
+{
+  unsigned int ii, jj, idx;
+
+  for (ii=0; ii<latero->inflight_count; ii++) {
+    idx = (latero->inflight_head + ii) % LATERO_MAX_PIPELINE_DEPTH;
+    if (latero->inflight_seq[idx] == seq) {
+      for (jj=0; jj<ii; jj++)
+        latero_complete_request( latero, latero->inflight_seq[(latero->inflight_head + jj) % LATERO_MAX_PIPELINE_DEPTH], 0 );
+      latero_complete_request( latero, seq, 1 );
+      latero->inflight_head = (idx + 1) % LATERO_MAX_PIPELINE_DEPTH;
+      latero->inflight_count -= ii + 1;
+      latero->stats.timeouts += ii;
+      latero->stats.responses++;
+      time_response( latero, latero->inflight_sent_ns[idx] );
+      return(1);
+    }
+  }
+  latero->stats.stale++;
+  return(0);
+}
+
+
+/**
+ * Wait for the response to the oldest request in flight, giving up on it once
+ * it is older than the response timeout. Responses to more recent requests are
+ * accepted as well.
+ * @return 1 if a response was received, 0 on timeout, -1 on error
+ */
+int wait_inflight(latero_t* latero, latero_pkt_t* response)
+{
+  int rv, timeout = response_timeout( latero );
+  unsigned int count = latero->inflight_count;
+  int64_t deadline = -1;
+
+  if (timeout >= 0)
+    deadline = latero->inflight_sent_ns[latero->inflight_head] / 1000 + timeout;
+
+  while (latero->inflight_count == count) {
+    rv = receive_packet( latero, deadline, response );
+    if (rv < 0)
+      return(-1);
+    if (rv == 0) {
+      latero_complete_request( latero, latero->inflight_seq[latero->inflight_head], 0 );
+      latero->inflight_head = (latero->inflight_head + 1) % LATERO_MAX_PIPELINE_DEPTH;
+      latero->inflight_count--;
+      rtt_timeout( latero );
+      return(0);
+    }
+    retire_inflight( latero, response->hdr.seq );
+  }
+  return(1);
+}
+
+
+int pipelined_exchange(latero_t* latero, char* buf, int len, latero_pkt_t* response)
+{
+  int rv, seq;
+  unsigned int idx;
+  latero_pkt_t rpkt;
+
+  response->hdr.type = PKT_TYPE_NONE;
+
+  /* only block if the pipeline is full */
+  while (latero->inflight_count >= latero->pipeline_depth) {
+    rv = wait_inflight( latero, &rpkt );
+    if (rv < 0)
+      return(-1);
+    if (rv > 0)
+      *response = rpkt;
+  }
+
+  idx = (latero->inflight_head + latero->inflight_count) % LATERO_MAX_PIPELINE_DEPTH;
+  latero->inflight_sent_ns[idx] = monotonic_ns();
+  seq = send_request( latero, buf, len );
+  if (seq < 0)
+    return(-1);
+  latero->inflight_seq[idx] = seq;
+  latero->inflight_count++;
+  latero->stats.requests++;
+
+  /* collect responses that have already arrived */
+  while ((rv = receive_packet( latero, 0, &rpkt )) > 0) {
+    if (retire_inflight( latero, rpkt.hdr.seq ))
+      *response = rpkt;
+  }
+  return(rv < 0 ? -1 : 0);
+}
+
+
+/**
+ * Send an encoded request (pktbuff or framebuff) and wait for its response.
+ * @return 0 on success, LATERO_TIMEOUT or LATERO_STALE if the response did not
+ *         arrive in time, -1 on error
+ */
+int exchange_request(latero_t* latero, char* buf, int len, latero_pkt_t* response)
+{
+  ssize_t numbytes;
+  int seq, rv, timeout, received = 0, stale = 0;
+  int64_t sent, deadline;
+  latero_pkt_t stale_pkt;
+
+  /* responses to pipelined requests would otherwise be mistaken for ours */
+  if (latero->inflight_count > 0 && latero_flush( latero, NULL ) < 0)
+    return(-1);
+
+  timeout = response_timeout( latero );
+  sent = monotonic_ns();
+  deadline = (timeout < 0) ? -1 : sent / 1000 + timeout;
+
+  if (latero->transport == LATERO_TRANSPORT_URING && latero->pipeline_depth == 1) {
+    /* send and receive in a single submission */
+    seq = stamp_seq( latero, buf );
+    numbytes = latero_uring_exchange( latero, buf, len, timeout );
     if ( numbytes < 0 ) {
-      fprintf(stderr,"Error receiving response\n");
+      LATERO_LOG_EVERY(1000, LATERO_LOG_ERROR, "Packet exchange error: %s", strerror(errno));
       return(-1);
     }
-#ifdef TIMEOUTS_ENABLED
+    latero_capture_packet( latero, LATERO_CAPTURE_TX, buf, len );
+    if ( numbytes > 0 ) {
+      latero->rx_wake_ns = monotonic_ns();
+      latero->rx_kernel_ns = 0;
+      latero_capture_packet( latero, LATERO_CAPTURE_RX, latero->rspbuff, numbytes );
+    }
+    if ( numbytes == 0 )
+      deadline = 0; /* timed out: only check for a response that is already there */
+    else if ( unpackPacket( latero->rspbuff, numbytes, response ) == 0 )
+      received = 1;
+    else
+      latero->stats.invalid++;
   } else {
-    printf("Warning! Timeout waiting from response from the Latero\n");
-    printf("  - Ensure that you use the right IP to communicate with the server.\n");
-    printf("  - Check that the server is running on the Latero.\n");
+    seq = send_request( latero, buf, len );
+    if (seq < 0)
+      return(-1);
   }
-#endif
-  unpackPacket( latero->rspbuff, BUFLEN, response );
-  return(0);
+  latero->stats.requests++;
+
+  /* skip late responses to earlier requests */
+  while (1) {
+    if (!received) {
+      rv = receive_packet( latero, deadline, response );
+      if (rv < 0)
+        return(-1);
+      if (rv == 0)
+        break;
+    }
+    received = 0;
+    if (match_response( latero, response, seq, sent ))
+      return(0);
+    stale_pkt = *response;
+    stale = 1;
+  }
+
+  rtt_timeout( latero );
+  if (stale) {
+    *response = stale_pkt;
+    return(LATERO_STALE);
+  }
+  response->hdr.type = PKT_TYPE_NONE;
+  return(LATERO_TIMEOUT);
+}
+
+
+int exchange_packet(latero_t* latero, latero_pkt_t* to_send, latero_pkt_t* response)
+{
+  int len = packPacket( latero->pktbuff, BUFLEN, to_send );
+
+  if ( len < 0 )
+    return(-1);
+  return exchange_request( latero, latero->pktbuff, len, response );
 }
 
 
@@ -138,22 +603,237 @@ int exchange_packet(latero_t* latero, latero_pkt_t* to_send, latero_pkt_t* respo
 
 int latero_write(latero_t* latero, latero_pkt_t* response)
 {
-	int ii;
-    latero_pkt_t pkt, rpkt;
+    latero_pkt_t rpkt;
+    int rv;
+    uint16_t seq = latero->seq; /* that stamped on the request */
+
+    if (response == NULL)
+        response = &rpkt;
+
+    /* the frame stays dirty until a response to it is received, which can
+       take several calls when requests are pipelined */
+    if (latero->frame_seq < 0)
+        latero->frame_seq = seq;
+    if (latero->pipeline_depth > 1) {
+        rv = pipelined_exchange(latero, latero->framebuff, LATERO_FULL_LEN, response);
+        if (rv < 0)
+            latero_complete_request(latero, seq, 0);
+    } else {
+        rv = exchange_request(latero, latero->framebuff, LATERO_FULL_LEN, response);
+        latero_complete_request(latero, seq, rv == 0);
+    }
+    return rv;
+}
+
+
+int latero_poll(latero_t* latero, latero_pkt_t* response)
+{
+    latero_pkt_t rpkt;
+    int rv;
 
+    if (latero->frame_dirty)
+        return latero_write(latero, response);
     if (response == NULL)
         response = &rpkt;
 
-	pkt.hdr.magic   = LATERO_MAGIC_NB;
-	pkt.hdr.version = PKT_VER_REV;
-    pkt.hdr.type    = PKT_TYPE_FULL;
-	pkt.full.dio_out = latero->dio_out;
-    for (ii=0; ii<4; ii++)
-      pkt.full.dac[ii] = latero->dac[ii];
-    for (ii=0; ii<64; ii++)
-	  pkt.full.blade[ii] = latero->pins[ii];
+    /* an IO request is the head of the FULL request, without the blades */
+    latero->framebuff[LATERO_TYPE_OFFSET] = PKT_TYPE_IO;
+    if (latero->pipeline_depth > 1)
+        rv = pipelined_exchange(latero, latero->framebuff, LATERO_IO_LEN, response);
+    else
+        rv = exchange_request(latero, latero->framebuff, LATERO_IO_LEN, response);
+    latero->framebuff[LATERO_TYPE_OFFSET] = PKT_TYPE_FULL;
+    return rv;
+}
+
+
+int latero_pack_state(latero_t* latero, char* buf, uint16_t* seq)
+{
+    uint16_t s = stamp_seq(latero, latero->framebuff);
+
+    memcpy(buf, latero->framebuff, LATERO_FULL_LEN);
+    if (latero->frame_seq < 0)
+        latero->frame_seq = s;
+    if (seq)
+        *seq = s;
+    return LATERO_FULL_LEN;
+}
 
-    return exchange_packet(latero, &pkt, response);
+
+void latero_complete_request(latero_t* latero, uint16_t seq, int acknowledged)
+{
+    if (latero->frame_seq != seq)
+        return;
+    /* once lost, the frame is tracked again from the next request sending it */
+    if (acknowledged)
+        latero->frame_dirty = 0;
+    latero->frame_seq = -1;
+}
+
+
+int latero_set_pipeline_depth(latero_t* latero, unsigned int depth)
+{
+    if (depth < 1 || depth > LATERO_MAX_PIPELINE_DEPTH)
+        return(-1);
+    while (latero->inflight_count > depth) {
+        latero_pkt_t rpkt;
+        if (wait_inflight(latero, &rpkt) < 0)
+            return(-1);
+    }
+    latero->pipeline_depth = depth;
+    return(0);
+}
+
+
+int latero_set_wait_strategy(latero_t* latero, latero_wait_strategy strategy)
+{
+    int sock = latero->udp_socket;
+    int flags;
+    struct timeval tv;
+
+    /* other backends do not wait on the socket: applied when switching back */
+    if (latero->transport != LATERO_TRANSPORT_SOCKET) {
+        if (strategy > LATERO_WAIT_BUSY_POLL)
+            return(-1);
+        latero->wait_strategy = strategy;
+        return(0);
+    }
+
+    if (strategy == LATERO_WAIT_SELECT) {
+        /* dissolve the association, if any */
+        struct sockaddr unspec;
+        memset(&unspec, 0, sizeof(unspec));
+        unspec.sa_family = AF_UNSPEC;
+        connect(sock, &unspec, sizeof(unspec));
+    } else if (strategy <= LATERO_WAIT_BUSY_POLL) {
+        if (connect(sock, (struct sockaddr*) &latero->si_server, sizeof(latero->si_server)) < 0)
+            return(-1);
+    } else {
+        return(-1);
+    }
+
+    flags = fcntl(sock, F_GETFL, 0);
+    if (flags < 0)
+        return(-1);
+    if (strategy == LATERO_WAIT_BUSY_POLL)
+        flags |= O_NONBLOCK;
+    else
+        flags &= ~O_NONBLOCK;
+    if (fcntl(sock, F_SETFL, flags) < 0)
+        return(-1);
+
+    /* no receive timeout outside of LATERO_WAIT_BLOCKING, where it is set on demand */
+    tv.tv_sec = 0;
+    tv.tv_usec = 0;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    latero->rcvtimeo_us = 0;
+
+#ifdef SO_BUSY_POLL
+    {
+        /* best effort: may require CAP_NET_ADMIN */
+        int busy_poll = (strategy == LATERO_WAIT_BUSY_POLL) ? BUSY_POLL_US : 0;
+        setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(busy_poll));
+    }
+#endif
+
+    latero->wait_strategy = strategy;
+    return(0);
+}
+
+
+int latero_set_transport(latero_t* latero, latero_transport transport)
+{
+    /* replaying is decided when opening the connection */
+    if (latero->transport == LATERO_TRANSPORT_REPLAY || transport == LATERO_TRANSPORT_REPLAY)
+        return(transport == latero->transport ? 0 : -1);
+
+    if (transport == LATERO_TRANSPORT_URING) {
+        /* the ring reads and writes the socket, which must then be connected */
+        if (connect(latero->udp_socket, (struct sockaddr*) &latero->si_server, sizeof(latero->si_server)) == 0
+            && latero_uring_open(latero) == 0) {
+            latero->transport = LATERO_TRANSPORT_URING;
+            return(0);
+        }
+        transport = LATERO_TRANSPORT_SOCKET;
+        latero->transport = transport;
+        latero_set_wait_strategy(latero, latero->wait_strategy);
+        return(-1);
+    }
+
+    latero_uring_close(latero);
+    latero->transport = LATERO_TRANSPORT_SOCKET;
+    return latero_set_wait_strategy(latero, latero->wait_strategy);
+}
+
+
+int latero_flush(latero_t* latero, latero_pkt_t* response)
+{
+    latero_pkt_t rpkt;
+    int rv;
+
+    if (response)
+        response->hdr.type = PKT_TYPE_NONE;
+    while (latero->inflight_count > 0) {
+        rv = wait_inflight(latero, &rpkt);
+        if (rv < 0)
+            return(-1);
+        if (rv > 0 && response)
+            *response = rpkt;
+    }
+    return(0);
+}
+
+
+void latero_report_timeout(latero_t* latero)
+{
+    rtt_timeout(latero);
+}
+
+
+void latero_update_rtt(latero_t* latero, int64_t rtt_us)
+{
+    latero_stats_t* st = &latero->stats;
+    double timeout;
+
+    /* smoothed mean and deviation, with the gains of TCP (RFC 6298) */
+    if (st->srtt_us <= 0) {
+        st->srtt_us = rtt_us;
+        st->rttvar_us = rtt_us / 2.0;
+    } else {
+        double err = rtt_us - st->srtt_us;
+        st->srtt_us += err / 8;
+        st->rttvar_us += (fabs(err) - st->rttvar_us) / 4;
+    }
+
+    timeout = st->srtt_us + RTT_K * st->rttvar_us;
+    if (timeout < RTT_MIN_TIMEOUT_US)
+        timeout = RTT_MIN_TIMEOUT_US;
+    if (timeout > RTT_MAX_TIMEOUT_US)
+        timeout = RTT_MAX_TIMEOUT_US;
+    st->timeout_us = (int) timeout;
+}
+
+
+void latero_get_stats(latero_t* latero, latero_stats_t* stats)
+{
+    *stats = latero->stats;
+}
+
+
+int latero_get_timing(latero_t* latero, latero_timing_t* timing)
+{
+    *timing = latero->timing;
+    return(latero->timing.wake_ns != 0 ? 0 : -1);
+}
+
+
+void latero_reset_stats(latero_t* latero)
+{
+    latero->stats.requests = 0;
+    latero->stats.responses = 0;
+    latero->stats.timeouts = 0;
+    latero->stats.stale = 0;
+    latero->stats.invalid = 0;
 }
 
 
@@ -190,14 +870,15 @@ int latero_raw_read(latero_t* latero, latero_dst_device destination, uint16_t ad
   raw_cmd_packet( command, address, 0x0000, &request);
   retcode = exchange_packet( latero, &request, &response );
   /* Extract the returned data (data remotely read) */
-  *data_read = response.raw.data;
+  if ( retcode == 0 )
+    *data_read = response.raw.data;
   return retcode;
 }
 
 
 int latero_open( latero_t* latero, const char* str_ip_address )
 {
-  int ii;
+  latero_pkt_t frame;
 
   latero->initialized = 0;
 
@@ -209,18 +890,56 @@ int latero_open( latero_t* latero, const char* str_ip_address )
   memset( (char *)latero->pktbuff, 0xFF, BUFLEN );
   memset( (char *)latero->rspbuff, 0xFF, BUFLEN );
 
-  for (ii=0; ii<4; ii++)
-    latero->dac[ii] = 0;
-
-  for (ii=0; ii<64; ii++)
-    latero->pins[ii] = 0x80; /* Initialize to mid position */
-
-  latero->dio_out = 0x1000; /* Now only one LED will be on */
+  /* Encode the initial state once; SET functions then patch it in place */
+  memset( &frame, 0, sizeof(frame) );
+  frame.hdr.magic   = LATERO_MAGIC_NB;
+  frame.hdr.version = PKT_VER_REV;
+  frame.hdr.type    = PKT_TYPE_FULL;
+  memset( frame.full.blade, 0x80, sizeof(frame.full.blade) ); /* Initialize to mid position */
+  frame.full.dio_out = 0x1000; /* Now only one LED will be on */
+  packPacket( latero->framebuff, LATERO_FULL_LEN, &frame );
+  latero->frame_dirty = 1;
+  latero->frame_seq = -1;
+
+  latero->seq = 0;
+  latero->pipeline_depth = 1;
+  latero->inflight_head = 0;
+  latero->inflight_count = 0;
+  latero->wait_strategy = LATERO_WAIT_SELECT;
+  latero->rcvtimeo_us = 0;
+  latero->transport = LATERO_TRANSPORT_SOCKET;
+  latero->uring = NULL;
+  latero->capture = NULL;
+  latero->capture_users = 0;
+  latero->replay = NULL;
+  latero->calib = NULL;
+  latero->seq_echo = 0;
+  memset( &latero->stats, 0, sizeof(latero->stats) );
+  latero->stats.timeout_us = RTT_MAX_TIMEOUT_US;
+  memset( &latero->timing, 0, sizeof(latero->timing) );
+  latero->rx_kernel_ns = 0;
+  latero->rx_wake_ns = 0;
 
   latero->udp_socket = socket( AF_INET, SOCK_DGRAM, IPPROTO_UDP );
   if (latero->udp_socket == -1)
     return(-1);
 
+#ifdef SO_TIMESTAMPNS
+  {
+    /* best effort: responses are then timed without the kernel timestamp */
+    int on = 1;
+    setsockopt( latero->udp_socket, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on) );
+  }
+#endif
+
+  if (strncmp( str_ip_address, LATERO_REPLAY_PREFIX, strlen(LATERO_REPLAY_PREFIX) ) == 0) {
+    if (latero_replay_open( latero, str_ip_address + strlen(LATERO_REPLAY_PREFIX) ) < 0) {
+      close( latero->udp_socket );
+      return(-1);
+    }
+    latero->transport = LATERO_TRANSPORT_REPLAY;
+  }
+
   latero->initialized = 1;
   return(0);
 }
@@ -229,9 +948,12 @@ int latero_open( latero_t* latero, const char* str_ip_address )
 int latero_close(latero_t* latero)
 {
 	latero->initialized = 0;
+    latero_capture_stop(latero);
+    latero_uring_close(latero);
+    latero_replay_close(latero);
     if ( close( latero->udp_socket ) != 0  )
     {
-      fprintf(stderr,"Closing failed on socket\n");
+      latero_log(LATERO_LOG_ERROR, "Closing failed on socket: %s", strerror(errno));
       return(-1);
     }
     return( 0 );
@@ -240,32 +962,89 @@ int latero_close(latero_t* latero)
 
 void latero_set_pins_raw(latero_t* latero, uint8_t* blade_values)
 {
-    int ii;
-    for (ii=0; ii<64; ii++)
-        latero->pins[ii] = blade_values[ii];
+    char* blade = latero->framebuff + LATERO_FULL_BLADE_OFFSET;
+    if (memcmp(blade, blade_values, LATERO_NB_PINS) != 0) {
+        memcpy(blade, blade_values, LATERO_NB_PINS);
+        latero->frame_dirty = 1;
+        latero->frame_seq = -1;
+    }
 }
 
 
 void latero_set_pins(latero_t* platero, double frame[LATERO_NB_PINS])
+{
+    /* quantize straight into the blades of the encoded request */
+    uint8_t* blade = (uint8_t*) platero->framebuff + LATERO_FULL_BLADE_OFFSET;
+    uint8_t changed = 0;
+    int i;
+    if (platero->calib) {
+        /* through the vectorized lookup, in single precision */
+        float x[LATERO_NB_PINS];
+        uint8_t raw[LATERO_NB_PINS];
+        for (i=0; i<LATERO_NB_PINS; ++i)
+            x[i] = (float) -frame[i];
+        latero_quantize_pins_f32_calib(x, x, 0.0f, platero->calib, raw, LATERO_NB_PINS);
+        for (i=0; i<LATERO_NB_PINS; ++i) {
+            changed |= raw[i] ^ blade[i];
+            blade[i] = raw[i];
+        }
+    } else {
+        for (i=0; i<LATERO_NB_PINS; ++i) {
+            uint8_t raw = (uint8_t) ((0.5-0.5*frame[i]) * LATERO_MAX_RAW_PIN);
+            changed |= raw ^ blade[i];
+            blade[i] = raw;
+        }
+    }
+    if (changed) {
+        platero->frame_dirty = 1;
+        platero->frame_seq = -1;
+    }
+}
+
+
+void latero_set_pins_fade(latero_t* latero, const double* from, const double* to, double ratio)
 {
     uint8_t raw[LATERO_NB_PINS];
     int i;
-    for (i=0; i<LATERO_NB_PINS; ++i)
-        raw[i] = (0.5-0.5*frame[i]) * LATERO_MAX_RAW_PIN;
-    latero_set_pins_raw(platero, raw);
+    if (latero->calib) {
+        float fromF[LATERO_NB_PINS], toF[LATERO_NB_PINS];
+        for (i=0; i<LATERO_NB_PINS; ++i) {
+            fromF[i] = (float) from[i];
+            toF[i] = (float) to[i];
+        }
+        latero_quantize_pins_f32_calib(fromF, toF, (float) ratio, latero->calib, raw, LATERO_NB_PINS);
+    }
+    else
+        latero_quantize_pins(from, to, ratio, raw, LATERO_NB_PINS);
+    latero_set_pins_raw(latero, raw);
+}
+
+
+int latero_set_calibration(latero_t* latero, const latero_calib_t* calib)
+{
+    if (calib && latero_calib_check(calib) < 0)
+        return(-1);
+    latero->calib = calib;
+    return(0);
+}
+
+
+const latero_calib_t* latero_get_calibration(const latero_t* latero)
+{
+    return latero->calib;
 }
 
 
 void latero_set_DAC(latero_t* latero, char index, uint16_t value)
 {
     assert(index < 4 && index >= 0);
-    latero->dac[index] = value;
+    patch_U16(latero->framebuff, LATERO_FULL_DAC_OFFSET + 2*index, value);
 };
 
 
 void latero_set_DIO(latero_t* latero, uint16_t value)
 {
-     latero->dio_out = value;
+     patch_U16(latero->framebuff, LATERO_FULL_DIO_OFFSET, value);
 };
 
 
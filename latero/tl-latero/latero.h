@@ -7,6 +7,12 @@ extern "C" {
 #include <netinet/in.h>
 #include "latero_io.h"
 
+// default address of the Latero
+#define LATERO_DEFAULT_IP "192.168.87.98"
+
+// prefix of the address of a connection that replays a capture, e.g. "replay:session.ltrc"
+#define LATERO_REPLAY_PREFIX "replay:"
+
 #define LATERO_NB_PINS_X 8
 #define LATERO_NB_PINS_Y 8
 #define LATERO_NB_PINS (LATERO_NB_PINS_X*LATERO_NB_PINS_Y)
@@ -32,6 +38,64 @@ extern "C" {
 #define LATERO_BUTTON0_MASK 0x0040
 #define LATERO_BUTTON1_MASK 0x0020
 
+// maximum number of requests that can be in flight in pipelined mode
+#define LATERO_MAX_PIPELINE_DEPTH 16
+
+/**
+ * How to wait for responses from the Latero. (ADVANCED)
+ * Strategies further down the list trade CPU time for lower latency and jitter.
+ */
+typedef enum
+{
+  LATERO_WAIT_SELECT,    // unconnected socket, select() before each receive (default)
+  LATERO_WAIT_CONNECTED, // connected socket using send()/recv(), poll() before each receive
+  LATERO_WAIT_BLOCKING,  // connected socket, blocking recv() bounded by SO_RCVTIMEO
+  LATERO_WAIT_BUSY_POLL  // connected non-blocking socket, spinning on recv() (with SO_BUSY_POLL if available)
+} latero_wait_strategy;
+
+/**
+ * Backend used to exchange packets with the Latero. (ADVANCED)
+ */
+typedef enum
+{
+  LATERO_TRANSPORT_SOCKET, // socket system calls, following the wait strategy (default)
+  LATERO_TRANSPORT_URING,  // io_uring, batching each exchange into a single system call (Linux only)
+  LATERO_TRANSPORT_REPLAY  // responses replayed from a capture (set by opening LATERO_REPLAY_PREFIX "<path>")
+} latero_transport;
+
+/* Return codes of exchanges that completed without their response */
+#define LATERO_TIMEOUT 1 // no response arrived in time
+#define LATERO_STALE   2 // only late responses to earlier requests arrived
+
+/**
+ * Exchange counters and round-trip time estimate of a connection. (ADVANCED)
+ * Responses are awaited for srtt_us + 4 rttvar_us (within 0.2 to 5 ms), and the
+ * timeout doubles after each request that goes unanswered.
+ */
+typedef struct
+{
+  unsigned long requests;  // requests sent
+  unsigned long responses; // responses matched to their request
+  unsigned long timeouts;  // requests whose response did not arrive in time
+  unsigned long stale;     // late responses to requests that had timed out
+  unsigned long invalid;   // datagrams that were not valid Latero packets
+  double srtt_us;          // smoothed round-trip time [us]
+  double rttvar_us;        // round-trip time variation [us]
+  int timeout_us;          // current response timeout [us]
+} latero_stats_t;
+
+/**
+ * Timing of an exchange, on the monotonic clock (CLOCK_MONOTONIC) [ns]. (ADVANCED)
+ * kernel_rx_ns - sent_ns is the round trip through the network and the Latero,
+ * and wake_ns - kernel_rx_ns the delay before the driver got to the response.
+ */
+typedef struct
+{
+  int64_t sent_ns;      // request sent
+  int64_t kernel_rx_ns; // response received by the kernel, 0 if the transport does not report it
+  int64_t wake_ns;      // response read by the driver
+} latero_timing_t;
+
 /* Opaque structure that defines a connection with the server
    Maintains a set of states and buffers.  Elements of this structure
    should only be modified by this API, not directly by the client.
@@ -43,10 +107,32 @@ typedef struct
   struct sockaddr_in si_server;
   char   pktbuff[BUFLEN];
   char   rspbuff[BUFLEN];
-  uint16_t dac[4];
-  uint8_t  pins[64];
-  uint16_t dio_out;
+  /* PKT_TYPE_FULL request holding the pins, DAC and DIO state. SET functions
+     write straight into it, and it is sent as is once its sequence number is
+     stamped. */
+  char   framebuff[LATERO_FULL_LEN];
+  char   frame_dirty;    // blades changed since framebuff was last acknowledged
+  int    frame_seq;      // sequence number of the first FULL request of framebuff in flight, -1 if none
   int encoder_offset[3]; // offset of encoder to 0 degrees
+  uint16_t seq;          // sequence number of the next request
+  unsigned int pipeline_depth; // maximum number of requests in flight (1: lockstep)
+  unsigned int inflight_head;  // index of the oldest request in flight
+  unsigned int inflight_count; // number of requests in flight
+  uint16_t inflight_seq[LATERO_MAX_PIPELINE_DEPTH]; // sequence numbers of requests in flight
+  int64_t inflight_sent_ns[LATERO_MAX_PIPELINE_DEPTH]; // send times of requests in flight [ns]
+  char seq_echo;         // the Latero was seen echoing sequence numbers
+  latero_stats_t stats;
+  int64_t rx_kernel_ns;  // kernel receive time of the last datagram read, 0 if unknown [ns]
+  int64_t rx_wake_ns;    // time at which the last datagram was read [ns]
+  latero_timing_t timing; // timing of the last response matched to its request
+  latero_wait_strategy wait_strategy;
+  int rcvtimeo_us;       // receive timeout currently set on the socket [us]
+  latero_transport transport;
+  void* uring;           // io_uring state, if any
+  void* capture;         // capture state, if any
+  int capture_users;     // latero_capture_packet() calls under way, which latero_capture_stop() waits for
+  void* replay;          // replayed capture, if any
+  const struct latero_calib* calib; // calibration of the pins, if any (see latero_set_calibration)
 } latero_t;
 
 
@@ -58,6 +144,8 @@ typedef enum x { LATERO_CONTROLLER, LATERO_IO } latero_dst_device;
 
 /*
  * Open connection to the Latero.
+ * @param str_ip_address  IP address of the Latero, or LATERO_REPLAY_PREFIX followed
+ *                        by the path of a capture to replay (see latero_capture_start)
  * @return 0 on success, negative on failure
  */
 int latero_open(latero_t* latero, const char* str_ip_address);
@@ -94,6 +182,35 @@ void latero_set_pins_raw(latero_t* latero, uint8_t* values);
 void latero_set_pins(latero_t* latero, double frame[LATERO_NB_PINS]);
 
 
+/**
+ * Sets the pins to a cross-fade between two frames, in a single vectorized pass
+ * (see latero_quantize_pins). Values go from -1.0 to 1.0 in the direction
+ * opposite to latero_set_pins().
+ * @param from   LATERO_NB_PINS values faded out (can be the same as to)
+ * @param to     LATERO_NB_PINS values faded in
+ * @param ratio  progress of the fade, from 0 (from) to 1 (to)
+ * @warning not effective until next write to device
+ */
+void latero_set_pins_fade(latero_t* latero, const double* from, const double* to, double ratio);
+
+
+/**
+ * Calibrate the pins set by latero_set_pins() and latero_set_pins_fade(), with
+ * a table for each pin in place of the LATERO_MAX_RAW_PIN scale (see
+ * latero_calib.h). The calibration is not copied: it must outlive its use.
+ * @param calib  calibration, NULL to go back to the LATERO_MAX_RAW_PIN scale
+ * @return 0 on success, negative if calib maps a pin above LATERO_MAX_RAW_PIN
+ *         (see latero_calib_check), in which case the calibration is unchanged
+ */
+int latero_set_calibration(latero_t* latero, const struct latero_calib* calib);
+
+
+/**
+ * @return calibration of the pins, NULL if none
+ */
+const struct latero_calib* latero_get_calibration(const latero_t* latero);
+
+
 /**
  * Set analog output value at a given index. (ADVANCED)
  * @param index  DAC index
@@ -115,12 +232,156 @@ void latero_set_DIO(latero_t* latero, uint16_t value);
 /**
  * Write currently set state to the Latero. This includes pins, DAC and DIO values.
  * Use SET functions to set these values before calling latero_write.
- * @param response  response packet returned by Latero (optional, can be set to NULL)
- * @return TODO
+ * @param response  response packet returned by Latero (optional, can be set to NULL).
+ *                  In pipelined mode, this is the most recent reply received, or a
+ *                  packet of type PKT_TYPE_NONE if none arrived during this call.
+ * @return 0 on success, negative on failure, or LATERO_TIMEOUT if no response
+ *         arrived in time (response is then of type PKT_TYPE_NONE), or LATERO_STALE
+ *         if only a late response to an earlier request did (it is then returned)
  */
 int latero_write(latero_t* latero, latero_pkt_t* response);
 
 
+/**
+ * Exchange the currently set state with the Latero, sending the blades only if
+ * they changed since they were last written. Otherwise, a PKT_TYPE_IO request
+ * (DAC and DIO only) is sent, which is enough to read the encoders and buttons.
+ * Use this rather than latero_write() to poll the Latero.
+ * @param response  as for latero_write()
+ * @return as for latero_write()
+ */
+int latero_poll(latero_t* latero, latero_pkt_t* response);
+
+
+/**
+ * Set the number of requests that latero_write() may keep in flight. (ADVANCED)
+ *
+ * With a depth of 1 (the default), every write waits for its response before
+ * returning. With a larger depth, latero_write() returns as soon as the request
+ * is sent, unless the pipeline is full, and the response it reports is the most
+ * recent reply received, matched to its request by sequence number. Throughput
+ * is then limited by the link rather than by the round-trip time.
+ *
+ * @param depth  1 to LATERO_MAX_PIPELINE_DEPTH
+ * @return 0 on success, negative if depth is out of range
+ * @warning pipelining relies on the Latero echoing the sequence number of requests
+ */
+int latero_set_pipeline_depth(latero_t* latero, unsigned int depth);
+
+
+/**
+ * Select how to wait for responses from the Latero. (ADVANCED)
+ * @return 0 on success, negative on failure (the strategy is then unchanged)
+ */
+int latero_set_wait_strategy(latero_t* latero, latero_wait_strategy strategy);
+
+
+/**
+ * Select the backend used to exchange packets with the Latero. (ADVANCED)
+ * The io_uring backend ignores the wait strategy, and falls back to the socket
+ * backend if io_uring is not available on the running system.
+ * @return 0 on success, negative if the backend is not available (the socket
+ *         backend is then used)
+ */
+int latero_set_transport(latero_t* latero, latero_transport transport);
+
+
+/**
+ * Wait for the responses to all requests in flight. (ADVANCED)
+ * @param response  most recent response received (optional, can be set to NULL).
+ *                  Its type is PKT_TYPE_NONE if no response was received.
+ * @return 0 on success, negative on failure
+ */
+int latero_flush(latero_t* latero, latero_pkt_t* response);
+
+
+/**
+ * Start capturing the packets exchanged with the Latero to a file. (ADVANCED)
+ * Packets are time-stamped and written by a background thread, without
+ * blocking the exchanges. Open a connection on LATERO_REPLAY_PREFIX "<path>" to
+ * replay the capture (see latero_capture.h for the file format).
+ * @return 0 on success, negative on failure
+ */
+int latero_capture_start(latero_t* latero, const char* path);
+
+
+/**
+ * Stop capturing, once all captured packets are written. (ADVANCED)
+ * Can be called while another thread exchanges packets on the connection,
+ * e.g. that of a TactileDisplay: it waits for that thread to be done with the
+ * capture before releasing it.
+ * @return 0 on success, negative on failure
+ */
+int latero_capture_stop(latero_t* latero);
+
+
+/**
+ * Set the pace of a connection that replays a capture. (ADVANCED)
+ * Requests are answered with the recorded responses, in order, when they are due.
+ * @param speed  1 for the recorded timing, 2 for twice as fast, etc., or 0 to
+ *               answer every request at once
+ * @return 0 on success, negative if the connection is not replaying a capture
+ */
+int latero_set_replay_speed(latero_t* latero, double speed);
+
+
+/**
+ * Get the exchange counters and round-trip time estimate. (ADVANCED)
+ */
+void latero_get_stats(latero_t* latero, latero_stats_t* stats);
+
+
+/**
+ * Get the timing of the last response matched to its request, i.e. of the
+ * response last reported by latero_write() or latero_poll() with a return
+ * value of 0. (ADVANCED)
+ * @return 0 on success, negative if no response was received yet
+ */
+int latero_get_timing(latero_t* latero, latero_timing_t* timing);
+
+
+/**
+ * Reset the exchange counters, keeping the round-trip time estimate. (ADVANCED)
+ */
+void latero_reset_stats(latero_t* latero);
+
+
+/**
+ * Update the round-trip time estimate with a measurement made outside of
+ * latero_write(), e.g. by a group. (ADVANCED)
+ */
+void latero_update_rtt(latero_t* latero, int64_t rtt_us);
+
+
+/**
+ * Report a request sent outside of latero_write(), e.g. by a group, that got
+ * no response in time: counts the timeout and backs off the response timeout,
+ * as latero_write() does. (ADVANCED)
+ */
+void latero_report_timeout(latero_t* latero);
+
+
+/**
+ * Encode the currently set state as the next request packet, without sending it.
+ * Used to drive several devices from a single socket. (ADVANCED)
+ * The state counts as displayed once the response to the packet is reported
+ * with latero_complete_request().
+ * @param buf  buffer of at least LATERO_FULL_LEN bytes
+ * @param seq  sequence number assigned to the packet (optional, can be set to NULL)
+ * @return length of the packet (LATERO_FULL_LEN)
+ */
+int latero_pack_state(latero_t* latero, char* buf, uint16_t* seq);
+
+
+/**
+ * Report the outcome of a request sent outside of latero_write(), e.g. by a
+ * group. (ADVANCED)
+ * @param seq           sequence number of the request
+ * @param acknowledged  1 if its response was received, 0 if it was given up on
+ */
+void latero_complete_request(latero_t* latero, uint16_t seq, int acknowledged);
+
+
 /**
  * Write a frame of blade values to the Latero. Combines set and write operations.
  * @param response  response packet returned by Latero (optional, can be set to NULL)
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "latero_calib.h"
+#include "latero_log.h"
+
+
+/***** PRIVATE API *****/
+
+/** resample a table of entries values to LATERO_CALIB_SIZE, linearly */
+static void calib_resample(const uint8_t* src, int entries, uint8_t* table)
+{
+  int j;
+  for (j=0; j<LATERO_CALIB_SIZE; ++j) {
+    double s = (double) j * (entries - 1) / (LATERO_CALIB_SIZE - 1);
+    int k = (int) s;
+    double a = src[k];
+    double b = (k + 1 < entries) ? src[k+1] : a;
+    table[j] = (uint8_t) (a + (b - a) * (s - k) + 0.5);
+  }
+}
+
+
+/***** PUBLIC API *****/
+
+void latero_calib_linear(latero_calib_t* calib)
+{
+  int pin, j;
+  for (pin=0; pin<LATERO_NB_PINS; ++pin)
+    for (j=0; j<LATERO_CALIB_SIZE; ++j)
+      calib->table[pin][j] = (uint8_t) (j * LATERO_MAX_RAW_PIN / (LATERO_CALIB_SIZE - 1));
+  memset(calib->padding, 0, sizeof(calib->padding));
+}
+
+
+int latero_calib_load(latero_calib_t* calib, const char* path)
+{
+  latero_calib_header_t hdr;
+  uint8_t* tables;
+  size_t size;
+  int pin, i;
+  FILE* f = fopen(path, "rb");
+
+  if (!f) {
+    latero_log(LATERO_LOG_ERROR, "Cannot open %s (%s)", path, strerror(errno));
+    return(-1);
+  }
+  if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != LATERO_CALIB_MAGIC
+      || hdr.version != LATERO_CALIB_VERSION) {
+    latero_log(LATERO_LOG_ERROR, "%s is not a Latero calibration", path);
+    fclose(f);
+    return(-1);
+  }
+  if (hdr.nb_pins != LATERO_NB_PINS || hdr.entries < 2 || hdr.entries > LATERO_CALIB_MAX_ENTRIES) {
+    latero_log(LATERO_LOG_ERROR, "%s holds %u tables of %u entries, expected %d tables",
+               path, hdr.nb_pins, hdr.entries, LATERO_NB_PINS);
+    fclose(f);
+    return(-1);
+  }
+
+  size = (size_t) hdr.nb_pins * hdr.entries;
+  tables = malloc(size);
+  if (!tables || fread(tables, 1, size, f) != size) {
+    latero_log(LATERO_LOG_ERROR, "%s is truncated", path);
+    free(tables);
+    fclose(f);
+    return(-1);
+  }
+  fclose(f);
+
+  // raw values past the end of the travel could damage the actuators
+  for (i=0; i<(int) size; ++i) {
+    if (tables[i] > LATERO_MAX_RAW_PIN) {
+      latero_log(LATERO_LOG_ERROR, "%s maps pin %d to raw %u, above %d",
+                 path, i / hdr.entries, tables[i], LATERO_MAX_RAW_PIN);
+      free(tables);
+      return(-1);
+    }
+  }
+
+  for (pin=0; pin<LATERO_NB_PINS; ++pin)
+    calib_resample(tables + pin * hdr.entries, hdr.entries, calib->table[pin]);
+  memset(calib->padding, 0, sizeof(calib->padding));
+  free(tables);
+  return(0);
+}
+
+
+int latero_calib_check(const latero_calib_t* calib)
+{
+  int pin, j;
+  for (pin=0; pin<LATERO_NB_PINS; ++pin) {
+    for (j=0; j<LATERO_CALIB_SIZE; ++j) {
+      if (calib->table[pin][j] > LATERO_MAX_RAW_PIN) {
+        latero_log(LATERO_LOG_ERROR, "Calibration maps pin %d to raw %u, above %d",
+                   pin, calib->table[pin][j], LATERO_MAX_RAW_PIN);
+        return(-1);
+      }
+    }
+  }
+  return(0);
+}
+
+
+int latero_calib_save(const latero_calib_t* calib, const char* path)
+{
+  latero_calib_header_t hdr;
+  FILE* f = fopen(path, "wb");
+  int ok;
+
+  if (!f) {
+    latero_log(LATERO_LOG_ERROR, "Cannot create %s (%s)", path, strerror(errno));
+    return(-1);
+  }
+  hdr.magic = LATERO_CALIB_MAGIC;
+  hdr.version = LATERO_CALIB_VERSION;
+  hdr.nb_pins = LATERO_NB_PINS;
+  hdr.entries = LATERO_CALIB_SIZE;
+  hdr.reserved = 0;
+  ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1
+    && fwrite(calib->table, sizeof(calib->table), 1, f) == 1;
+  if (fclose(f) != 0 || !ok) {
+    latero_log(LATERO_LOG_ERROR, "Cannot write %s", path);
+    return(-1);
+  }
+  return(0);
+}
+
+
+uint8_t latero_calib_lookup(const latero_calib_t* calib, int pin, double x)
+{
+  x = (x > -1.0) ? x : -1.0; // NaN compares false
+  x = (x < 1.0) ? x : 1.0;
+  return calib->table[pin][(int) ((0.5 + 0.5 * x) * (LATERO_CALIB_SIZE - 1))];
+}
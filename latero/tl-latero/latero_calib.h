@@ -0,0 +1,81 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "latero.h"
+
+/*
+ * Calibration of the actuators. Each pin has its own table giving the raw value
+ * that puts it at a position of its travel, sampled at LATERO_CALIB_SIZE
+ * positions from raw 0 (entry 0) to the other end (last entry). Once set on a
+ * connection (see latero_set_calibration), the tables replace the single
+ * LATERO_MAX_RAW_PIN scale when frames are quantized.
+ *
+ * A calibration file is a latero_calib_header_t followed by nb_pins tables of
+ * entries bytes each, in the order of the pins, in host byte order. Tables of
+ * any size are resampled to LATERO_CALIB_SIZE entries when loaded.
+ */
+
+#define LATERO_CALIB_MAGIC   0x4C41434C // "LCAL"
+#define LATERO_CALIB_VERSION 1
+
+// entries of the table of a pin, so that positions are indexed by a byte
+#define LATERO_CALIB_SIZE 256
+
+// largest number of entries of the tables of a calibration file
+#define LATERO_CALIB_MAX_ENTRIES 4096
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  uint16_t nb_pins; // LATERO_NB_PINS
+  uint16_t entries; // entries of each table, from 2 to LATERO_CALIB_MAX_ENTRIES
+  uint32_t reserved;
+} latero_calib_header_t;
+
+typedef struct latero_calib
+{
+  uint8_t table[LATERO_NB_PINS][LATERO_CALIB_SIZE]; // raw values, up to LATERO_MAX_RAW_PIN
+  uint8_t padding[4]; // read past the last table by the vectorized lookup
+} latero_calib_t;
+
+
+/**
+ * Fill a calibration with the tables equivalent to no calibration, within one
+ * raw step: the same linear mapping to [0, LATERO_MAX_RAW_PIN] for every pin.
+ */
+void latero_calib_linear(latero_calib_t* calib);
+
+/**
+ * Load a calibration file.
+ * @return 0 on success, negative if the file cannot be read or is not a
+ *         calibration of this device (calib is then left unchanged)
+ */
+int latero_calib_load(latero_calib_t* calib, const char* path);
+
+/**
+ * Check that a calibration keeps the pins within their travel.
+ * @return 0 if it does, negative if a table holds a raw value above
+ *         LATERO_MAX_RAW_PIN, which could damage the actuators
+ */
+int latero_calib_check(const latero_calib_t* calib);
+
+/**
+ * Save a calibration file, with LATERO_CALIB_SIZE entries per table.
+ * @return 0 on success, negative on failure
+ */
+int latero_calib_save(const latero_calib_t* calib, const char* path);
+
+/**
+ * @return raw value of a pin at a position of its travel
+ * @param x  position, from -1.0 (raw 0) to 1.0, clamped
+ */
+uint8_t latero_calib_lookup(const latero_calib_t* calib, int pin, double x);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,450 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "latero_capture.h"
+#include "latero_log.h"
+
+// number of packets that can wait for the writer (power of two)
+#define CAPTURE_RING 1024
+
+// the log file grows by this many records at a time
+#define CAPTURE_CHUNK 8192
+
+// interval at which the writer checks for new packets [us]
+#define CAPTURE_POLL_US 1000
+
+// records searched after a request for its response, when loading a log
+#define REPLAY_WINDOW 64
+
+// maximum number of replayed requests awaiting their response
+#define REPLAY_PENDING 32
+
+typedef struct
+{
+  int fd;
+  char* map;             // mapping of the log file
+  size_t map_records;    // number of records the mapping can hold
+  size_t nb_records;     // number of records written
+  latero_capture_record_t ring[CAPTURE_RING];
+  unsigned long head;    // next record to fill (connection thread)
+  unsigned long tail;    // next record to write (writer thread)
+  unsigned long dropped;
+  int stop;
+  pthread_t thread;
+} latero_capture_t;
+
+typedef struct
+{
+  long tx;               // index of the request record
+  long rx;               // index of its response, -1 if it got none
+} replay_exchange_t;
+
+typedef struct
+{
+  const latero_capture_record_t* records;
+  size_t map_size;
+  replay_exchange_t* exchanges;
+  size_t nb_exchanges;
+  size_t next;           // next exchange to replay
+  int64_t loop_ns;       // time added to the records by the loops over the log so far [ns]
+  double speed;
+  int64_t t0_us;         // time at which the pacing was anchored, 0 to anchor on the next request [us]
+  int64_t base_ns;       // recorded time matching t0_us [ns]
+  struct {
+    size_t exchange;
+    int64_t loop_ns;
+    uint16_t seq;
+  } pending[REPLAY_PENDING];
+  unsigned int pending_head, pending_count;
+} latero_replay_t;
+
+
+/***** PRIVATE API *****/
+
+static int64_t capture_monotonic_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static void capture_sleep_us(int64_t us)
+{
+  struct timespec ts;
+  ts.tv_sec = us / 1000000;
+  ts.tv_nsec = (long)(us % 1000000) * 1000;
+  nanosleep(&ts, NULL);
+}
+
+
+/** Map room for at least nb_records records in the log file. */
+static int capture_grow(latero_capture_t* cap, size_t nb_records)
+{
+  size_t records = cap->map_records + CAPTURE_CHUNK;
+  size_t size;
+  char* map;
+
+  while (records < nb_records)
+    records += CAPTURE_CHUNK;
+  size = sizeof(latero_capture_header_t) + records * sizeof(latero_capture_record_t);
+  if (ftruncate(cap->fd, size) < 0)
+    return(-1);
+  map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, cap->fd, 0);
+  if (map == MAP_FAILED)
+    return(-1);
+  if (cap->map)
+    munmap(cap->map, sizeof(latero_capture_header_t) + cap->map_records * sizeof(latero_capture_record_t));
+  cap->map = map;
+  cap->map_records = records;
+  return(0);
+}
+
+
+static void* capture_writer(void* arg)
+{
+  latero_capture_t* cap = arg;
+  latero_capture_record_t* dst;
+  unsigned long head;
+  int stop;
+
+  do {
+    stop = __atomic_load_n(&cap->stop, __ATOMIC_ACQUIRE);
+    head = __atomic_load_n(&cap->head, __ATOMIC_ACQUIRE);
+    while (cap->tail != head) {
+      if (cap->nb_records >= cap->map_records && capture_grow(cap, cap->nb_records + 1) < 0) {
+        latero_log(LATERO_LOG_ERROR, "Capture stopped: cannot extend the log (%s)", strerror(errno));
+        __atomic_store_n(&cap->tail, head, __ATOMIC_RELEASE);
+        return NULL;
+      }
+      dst = (latero_capture_record_t*)(cap->map + sizeof(latero_capture_header_t)) + cap->nb_records;
+      *dst = cap->ring[cap->tail % CAPTURE_RING];
+      cap->nb_records++;
+      __atomic_store_n(&cap->tail, cap->tail + 1, __ATOMIC_RELEASE);
+    }
+    if (!stop)
+      capture_sleep_us(CAPTURE_POLL_US);
+  } while (!stop);
+  return NULL;
+}
+
+
+/** Append a packet to the ring of a capture, unless it is full. */
+static void capture_append(latero_capture_t* cap, uint8_t direction, const char* buf, size_t len)
+{
+  latero_capture_record_t* rec;
+
+  if (len < LATERO_HDR_LEN) // not a packet, and refused by replay
+    return;
+  if (cap->head - __atomic_load_n(&cap->tail, __ATOMIC_ACQUIRE) >= CAPTURE_RING) {
+    cap->dropped++;
+    return;
+  }
+
+  rec = &cap->ring[cap->head % CAPTURE_RING];
+  if (len > BUFLEN)
+    len = BUFLEN;
+  rec->time_ns = capture_monotonic_ns();
+  rec->seq = (uint16_t)(((uint8_t)buf[LATERO_SEQ_OFFSET] << 8) | (uint8_t)buf[LATERO_SEQ_OFFSET+1]);
+  rec->direction = direction;
+  rec->length = len;
+  memcpy(rec->data, buf, len);
+  __atomic_store_n(&cap->head, cap->head + 1, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * Check the records read from a log, which replay trusts: a truncated or
+ * corrupted file must not make it copy more than a packet buffer.
+ * @return index of the first invalid record, -1 if all are valid
+ */
+static long replay_check(const latero_capture_record_t* records, size_t nb_records)
+{
+  size_t ii;
+
+  for (ii=0; ii<nb_records; ii++) {
+    const latero_capture_record_t* rec = &records[ii];
+    if (rec->length > BUFLEN || rec->length < LATERO_HDR_LEN
+        || (rec->direction != LATERO_CAPTURE_TX && rec->direction != LATERO_CAPTURE_RX))
+      return((long) ii);
+  }
+  return(-1);
+}
+
+
+/** Pair each request of the log with the response carrying its sequence number. */
+static int replay_index(latero_replay_t* rp, size_t nb_records)
+{
+  size_t ii, jj;
+  char* claimed = calloc(nb_records, 1);
+
+  rp->exchanges = malloc(nb_records * sizeof(replay_exchange_t));
+  if (!claimed || !rp->exchanges) {
+    free(claimed);
+    return(-1);
+  }
+  rp->nb_exchanges = 0;
+  for (ii=0; ii<nb_records; ii++) {
+    replay_exchange_t* ex;
+    if (rp->records[ii].direction != LATERO_CAPTURE_TX)
+      continue;
+    ex = &rp->exchanges[rp->nb_exchanges++];
+    ex->tx = ii;
+    ex->rx = -1;
+    for (jj=ii+1; jj<nb_records && jj<=ii+REPLAY_WINDOW; jj++) {
+      if (rp->records[jj].direction == LATERO_CAPTURE_RX && !claimed[jj]
+          && rp->records[jj].seq == rp->records[ii].seq) {
+        ex->rx = jj;
+        claimed[jj] = 1;
+        break;
+      }
+    }
+  }
+  free(claimed);
+  return(rp->nb_exchanges > 0 ? 0 : -1);
+}
+
+
+/***** PUBLIC API *****/
+
+int latero_capture_start(latero_t* latero, const char* path)
+{
+  latero_capture_t* cap;
+  latero_capture_header_t* hdr;
+
+  latero_capture_stop(latero);
+
+  cap = calloc(1, sizeof(latero_capture_t));
+  if (!cap)
+    return(-1);
+  cap->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (cap->fd < 0 || capture_grow(cap, 0) < 0)
+    goto fail;
+
+  hdr = (latero_capture_header_t*) cap->map;
+  hdr->magic = LATERO_CAPTURE_MAGIC;
+  hdr->version = LATERO_CAPTURE_VERSION;
+  hdr->record_size = sizeof(latero_capture_record_t);
+  hdr->reserved = 0;
+
+  if (pthread_create(&cap->thread, NULL, capture_writer, cap) != 0)
+    goto fail;
+  __atomic_store_n(&latero->capture, cap, __ATOMIC_RELEASE);
+  return(0);
+
+fail:
+  if (cap->map)
+    munmap(cap->map, sizeof(latero_capture_header_t) + cap->map_records * sizeof(latero_capture_record_t));
+  if (cap->fd >= 0)
+    close(cap->fd);
+  free(cap);
+  return(-1);
+}
+
+
+int latero_capture_stop(latero_t* latero)
+{
+  latero_capture_t* cap = __atomic_exchange_n(&latero->capture, NULL, __ATOMIC_SEQ_CST);
+  int rv = 0;
+
+  if (!cap)
+    return(0);
+  /* the connection thread may have taken the capture before it was unpublished */
+  while (__atomic_load_n(&latero->capture_users, __ATOMIC_SEQ_CST) > 0)
+    sched_yield();
+
+  __atomic_store_n(&cap->stop, 1, __ATOMIC_RELEASE);
+  pthread_join(cap->thread, NULL);
+
+  munmap(cap->map, sizeof(latero_capture_header_t) + cap->map_records * sizeof(latero_capture_record_t));
+  if (ftruncate(cap->fd, sizeof(latero_capture_header_t) + cap->nb_records * sizeof(latero_capture_record_t)) < 0)
+    rv = -1;
+  close(cap->fd);
+  if (cap->dropped)
+    latero_log(LATERO_LOG_WARNING, "Capture dropped %lu packets", cap->dropped);
+  free(cap);
+  return(rv);
+}
+
+
+void latero_capture_packet(latero_t* latero, uint8_t direction, const char* buf, size_t len)
+{
+  latero_capture_t* cap;
+
+  if (!__atomic_load_n(&latero->capture, __ATOMIC_RELAXED))
+    return;
+
+  /* announce the use before taking the pointer, so that latero_capture_stop()
+     either sees the use or hides the capture from us */
+  __atomic_add_fetch(&latero->capture_users, 1, __ATOMIC_SEQ_CST);
+  cap = __atomic_load_n(&latero->capture, __ATOMIC_SEQ_CST);
+  if (cap)
+    capture_append(cap, direction, buf, len);
+  __atomic_sub_fetch(&latero->capture_users, 1, __ATOMIC_RELEASE);
+}
+
+
+int latero_replay_open(latero_t* latero, const char* path)
+{
+  latero_replay_t* rp;
+  const latero_capture_header_t* hdr;
+  struct stat st;
+  size_t nb_records;
+  long bad;
+  void* map;
+  int fd;
+
+  latero_replay_close(latero);
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return(-1);
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(latero_capture_header_t)) {
+    close(fd);
+    return(-1);
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return(-1);
+
+  hdr = map;
+  rp = calloc(1, sizeof(latero_replay_t));
+  if (!rp || hdr->magic != LATERO_CAPTURE_MAGIC || hdr->version != LATERO_CAPTURE_VERSION
+      || hdr->record_size != sizeof(latero_capture_record_t)) {
+    latero_log(LATERO_LOG_ERROR, "%s is not a Latero capture", path);
+    free(rp);
+    munmap(map, st.st_size);
+    return(-1);
+  }
+  rp->records = (const latero_capture_record_t*)((const char*)map + sizeof(latero_capture_header_t));
+  rp->map_size = st.st_size;
+  rp->speed = 1.0;
+  nb_records = (st.st_size - sizeof(latero_capture_header_t)) / sizeof(latero_capture_record_t);
+  bad = replay_check(rp->records, nb_records);
+  if (bad >= 0) {
+    latero_log(LATERO_LOG_ERROR, "%s holds an invalid record (%ld)", path, bad);
+    free(rp);
+    munmap(map, st.st_size);
+    return(-1);
+  }
+  if (replay_index(rp, nb_records) < 0) {
+    latero_log(LATERO_LOG_ERROR, "%s holds no request to replay", path);
+    free(rp->exchanges);
+    free(rp);
+    munmap(map, st.st_size);
+    return(-1);
+  }
+  latero->replay = rp;
+  return(0);
+}
+
+
+void latero_replay_close(latero_t* latero)
+{
+  latero_replay_t* rp = latero->replay;
+
+  if (!rp)
+    return;
+  munmap((char*)rp->records - sizeof(latero_capture_header_t), rp->map_size);
+  free(rp->exchanges);
+  free(rp);
+  latero->replay = NULL;
+}
+
+
+int latero_set_replay_speed(latero_t* latero, double speed)
+{
+  latero_replay_t* rp = latero->replay;
+
+  if (!rp || speed < 0)
+    return(-1);
+  rp->speed = speed;
+  rp->t0_us = 0; /* pace from the next request on */
+  return(0);
+}
+
+
+ssize_t latero_replay_send(latero_t* latero, const char* buf, size_t len)
+{
+  latero_replay_t* rp = latero->replay;
+  const latero_capture_record_t* tx = &rp->records[rp->exchanges[rp->next].tx];
+  unsigned int idx;
+
+  if (rp->t0_us == 0) {
+    rp->t0_us = capture_monotonic_ns() / 1000;
+    rp->base_ns = tx->time_ns + rp->loop_ns;
+  }
+
+  /* the oldest request is given up on if too many are waiting */
+  if (rp->pending_count == REPLAY_PENDING) {
+    rp->pending_head = (rp->pending_head + 1) % REPLAY_PENDING;
+    rp->pending_count--;
+  }
+  idx = (rp->pending_head + rp->pending_count) % REPLAY_PENDING;
+  rp->pending[idx].exchange = rp->next;
+  rp->pending[idx].loop_ns = rp->loop_ns;
+  rp->pending[idx].seq = (len >= LATERO_HDR_LEN) ? (uint16_t)(((uint8_t)buf[LATERO_SEQ_OFFSET] << 8) | (uint8_t)buf[LATERO_SEQ_OFFSET+1]) : 0;
+  rp->pending_count++;
+
+  /* loop over the log, keeping time going forward */
+  if (++rp->next == rp->nb_exchanges) {
+    const latero_capture_record_t* first = &rp->records[rp->exchanges[0].tx];
+    const latero_capture_record_t* last = &rp->records[rp->exchanges[rp->nb_exchanges-1].tx];
+    rp->loop_ns += last->time_ns - first->time_ns + (rp->nb_exchanges > 1 ? (last->time_ns - first->time_ns) / (rp->nb_exchanges - 1) : 0);
+    rp->next = 0;
+  }
+  return(len);
+}
+
+
+ssize_t latero_replay_recv(latero_t* latero, int us_timeout)
+{
+  latero_replay_t* rp = latero->replay;
+  int64_t now = capture_monotonic_ns() / 1000;
+  int64_t limit = (us_timeout < 0) ? INT64_MAX : now + us_timeout;
+
+  while (rp->pending_count > 0) {
+    const replay_exchange_t* ex = &rp->exchanges[rp->pending[rp->pending_head].exchange];
+    const latero_capture_record_t* rx;
+    int64_t due = now;
+    uint16_t seq = rp->pending[rp->pending_head].seq;
+
+    if (ex->rx < 0) {
+      /* no response was recorded: the request is lost */
+      rp->pending_head = (rp->pending_head + 1) % REPLAY_PENDING;
+      rp->pending_count--;
+      continue;
+    }
+
+    rx = &rp->records[ex->rx];
+    if (rp->speed > 0)
+      due = rp->t0_us + (int64_t)((rx->time_ns + rp->pending[rp->pending_head].loop_ns - rp->base_ns) / 1000 / rp->speed);
+    if (due > limit) {
+      if (us_timeout > 0)
+        capture_sleep_us(us_timeout);
+      return(0);
+    }
+    if (due > now)
+      capture_sleep_us(due - now);
+
+    memcpy(latero->rspbuff, rx->data, rx->length);
+    latero->rspbuff[LATERO_SEQ_OFFSET] = seq >> 8;
+    latero->rspbuff[LATERO_SEQ_OFFSET+1] = seq & 0xFF;
+    rp->pending_head = (rp->pending_head + 1) % REPLAY_PENDING;
+    rp->pending_count--;
+    return(rx->length);
+  }
+
+  if (us_timeout > 0)
+    capture_sleep_us(us_timeout);
+  return(0);
+}
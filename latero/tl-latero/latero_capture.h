@@ -0,0 +1,84 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "latero.h"
+
+/*
+ * Packet capture and replay. While capturing, every packet sent to or received
+ * from the Latero is appended to a ring, which a background thread copies into
+ * a memory-mapped log file. A connection opened on "replay:<path>" (see
+ * LATERO_REPLAY_PREFIX) answers requests with the responses of such a log,
+ * paced as they were recorded. Capture is controlled with latero_capture_start()
+ * and latero_capture_stop() in latero.h; the other functions are used
+ * internally by latero.c.
+ *
+ * A log is a latero_capture_header_t followed by latero_capture_record_t
+ * records, in host byte order (the packets themselves are kept as on the wire).
+ */
+
+#define LATERO_CAPTURE_MAGIC   0x4352544C // "LTRC"
+#define LATERO_CAPTURE_VERSION 1
+
+// direction of a captured packet
+#define LATERO_CAPTURE_TX 0 // request sent to the Latero
+#define LATERO_CAPTURE_RX 1 // datagram received from the Latero
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t record_size; // sizeof(latero_capture_record_t)
+  uint32_t reserved;
+} latero_capture_header_t;
+
+typedef struct
+{
+  int64_t time_ns;   // monotonic time at which the packet was sent or received [ns]
+  uint16_t seq;      // sequence number, as found in the packet
+  uint8_t direction; // LATERO_CAPTURE_TX or LATERO_CAPTURE_RX
+  uint8_t length;    // number of bytes of data
+  uint8_t reserved[4];
+  uint8_t data[BUFLEN];
+} latero_capture_record_t;
+
+
+/**
+ * Append a packet to the capture of a connection, if any. Never blocks: the
+ * packet is dropped if the writer falls behind. Datagrams shorter than a
+ * packet header are not captured.
+ */
+void latero_capture_packet(latero_t* latero, uint8_t direction, const char* buf, size_t len);
+
+/**
+ * Load a log to replay on a connection.
+ * @return 0 on success, negative if the file is not a valid log, or holds a
+ *         record longer than BUFLEN, shorter than a header or of an unknown
+ *         direction
+ */
+int latero_replay_open(latero_t* latero, const char* path);
+
+/** Unload the log, if any. */
+void latero_replay_close(latero_t* latero);
+
+/**
+ * Take a request, which will be answered by the response recorded for the next
+ * request of the log.
+ * @return len
+ */
+ssize_t latero_replay_send(latero_t* latero, const char* buf, size_t len);
+
+/**
+ * Receive the next recorded response into rspbuff, once it is due.
+ * @param us_timeout  timeout [us], 0 to return immediately, negative to wait forever
+ * @return number of bytes received, 0 on timeout
+ */
+ssize_t latero_replay_recv(latero_t* latero, int us_timeout);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,270 @@
+#ifdef __linux__
+#define _GNU_SOURCE // sendmmsg(), recvmmsg() and ppoll()
+#endif
+
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "latero_group.h"
+#include "latero_log.h"
+
+/***** PRIVATE API *****/
+
+int64_t group_monotonic_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/** @return time to wait for all responses [us]: the longest response timeout of the devices */
+int group_timeout(latero_group_t* group)
+{
+  unsigned int ii;
+  int timeout = 0;
+
+  for (ii=0; ii<group->nb_devices; ii++)
+    if (group->devices[ii]->stats.timeout_us > timeout)
+      timeout = group->devices[ii]->stats.timeout_us;
+  return(timeout);
+}
+
+
+/** Wait until the socket is readable or for at most us_timeout [us]. */
+int group_wait(latero_group_t* group, int64_t us_timeout)
+{
+  struct pollfd pfd;
+
+  pfd.fd = group->udp_socket;
+  pfd.events = POLLIN;
+#ifdef __linux__
+  {
+    struct timespec ts;
+    ts.tv_sec = us_timeout / 1000000;
+    ts.tv_nsec = (long)(us_timeout % 1000000) * 1000;
+    return ppoll(&pfd, 1, &ts, NULL);
+  }
+#else
+  return poll(&pfd, 1, (int)((us_timeout + 999) / 1000));
+#endif
+}
+
+
+/**
+ * Match a response to the device it came from.
+ * @return index of the device, -1 if the response is unexpected
+ */
+int group_match(latero_group_t* group, const struct sockaddr_in* from, latero_pkt_t* response,
+                const int* completed)
+{
+  unsigned int ii;
+
+  for (ii=0; ii<group->nb_devices; ii++) {
+    const struct sockaddr_in* addr = &group->devices[ii]->si_server;
+    if (addr->sin_addr.s_addr == from->sin_addr.s_addr && addr->sin_port == from->sin_port)
+      return (!completed[ii] && response->hdr.seq == group->seq[ii]) ? (int)ii : -1;
+  }
+  return(-1);
+}
+
+
+/**
+ * Give up on the requests of the devices that did not respond.
+ * @param timed_out  1 if they got no response in time, which backs off their
+ *                   response timeout, 0 if the exchange failed
+ */
+void group_give_up(latero_group_t* group, const int* completed, int timed_out)
+{
+  unsigned int ii;
+
+  for (ii=0; ii<group->nb_devices; ii++) {
+    if (completed[ii])
+      continue;
+    latero_complete_request(group->devices[ii], group->seq[ii], 0);
+    if (timed_out)
+      latero_report_timeout(group->devices[ii]);
+  }
+}
+
+
+int group_send(latero_group_t* group, const int* lengths)
+{
+  unsigned int ii;
+#ifdef __linux__
+  struct mmsghdr msgs[LATERO_GROUP_MAX_DEVICES];
+  struct iovec iovecs[LATERO_GROUP_MAX_DEVICES];
+  unsigned int sent = 0;
+  int rv;
+
+  memset(msgs, 0, sizeof(msgs));
+  for (ii=0; ii<group->nb_devices; ii++) {
+    iovecs[ii].iov_base = group->pktbuff[ii];
+    iovecs[ii].iov_len = lengths[ii];
+    msgs[ii].msg_hdr.msg_iov = &iovecs[ii];
+    msgs[ii].msg_hdr.msg_iovlen = 1;
+    msgs[ii].msg_hdr.msg_name = &group->devices[ii]->si_server;
+    msgs[ii].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+  }
+  while (sent < group->nb_devices) {
+    rv = sendmmsg(group->udp_socket, msgs + sent, group->nb_devices - sent, 0);
+    if (rv < 0 && errno != EINTR)
+      return(-1);
+    if (rv > 0)
+      sent += rv;
+  }
+#else
+  for (ii=0; ii<group->nb_devices; ii++) {
+    if (sendto(group->udp_socket, group->pktbuff[ii], lengths[ii], 0,
+               (struct sockaddr*) &group->devices[ii]->si_server, sizeof(struct sockaddr_in)) < 0)
+      return(-1);
+  }
+#endif
+  return(0);
+}
+
+
+/**
+ * Receive the datagrams that are available without blocking.
+ * @param lengths  set to the length of each datagram received
+ * @return number of datagrams received in rspbuff, negative on failure
+ */
+int group_recv(latero_group_t* group, int* lengths)
+{
+  int ii, rv;
+#ifdef __linux__
+  struct mmsghdr msgs[LATERO_GROUP_MAX_DEVICES];
+  struct iovec iovecs[LATERO_GROUP_MAX_DEVICES];
+
+  memset(msgs, 0, sizeof(msgs));
+  for (ii=0; ii<(int)group->nb_devices; ii++) {
+    iovecs[ii].iov_base = group->rspbuff[ii];
+    iovecs[ii].iov_len = BUFLEN;
+    msgs[ii].msg_hdr.msg_iov = &iovecs[ii];
+    msgs[ii].msg_hdr.msg_iovlen = 1;
+    msgs[ii].msg_hdr.msg_name = &group->si_other[ii];
+    msgs[ii].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+  }
+  rv = recvmmsg(group->udp_socket, msgs, group->nb_devices, MSG_DONTWAIT, NULL);
+  if (rv < 0)
+    return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+  for (ii=0; ii<rv; ii++)
+    lengths[ii] = msgs[ii].msg_len;
+#else
+  for (rv=0; rv<(int)group->nb_devices; rv++) {
+    socklen_t slen = sizeof(struct sockaddr_in);
+    ssize_t numbytes = recvfrom(group->udp_socket, group->rspbuff[rv], BUFLEN, MSG_DONTWAIT,
+                                (struct sockaddr*) &group->si_other[rv], &slen);
+    if (numbytes < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        break;
+      return(-1);
+    }
+    lengths[rv] = numbytes;
+  }
+#endif
+  return(rv);
+}
+
+
+/***** PUBLIC API *****/
+
+int latero_group_open(latero_group_t* group, latero_t** devices, unsigned int nb_devices)
+{
+  unsigned int ii;
+
+  if (nb_devices > LATERO_GROUP_MAX_DEVICES)
+    return(-1);
+
+  group->nb_devices = nb_devices;
+  for (ii=0; ii<nb_devices; ii++)
+    group->devices[ii] = devices[ii];
+
+  group->udp_socket = socket( AF_INET, SOCK_DGRAM, IPPROTO_UDP );
+  if (group->udp_socket == -1)
+    return(-1);
+  return(0);
+}
+
+
+int latero_group_close(latero_group_t* group)
+{
+  if ( close( group->udp_socket ) != 0 ) {
+    latero_log(LATERO_LOG_ERROR, "Closing failed on socket: %s", strerror(errno));
+    return(-1);
+  }
+  return(0);
+}
+
+
+int latero_group_write(latero_group_t* group, latero_pkt_t* responses, int* completed)
+{
+  int lengths[LATERO_GROUP_MAX_DEVICES];
+  int done[LATERO_GROUP_MAX_DEVICES];
+  unsigned int ii;
+  int jj, rv, nb_received, nb_done = 0;
+  int64_t sent, deadline;
+  latero_pkt_t rpkt;
+
+  for (ii=0; ii<group->nb_devices; ii++) {
+    lengths[ii] = latero_pack_state(group->devices[ii], group->pktbuff[ii], &group->seq[ii]);
+    done[ii] = 0;
+    if (responses)
+      responses[ii].hdr.type = PKT_TYPE_NONE;
+  }
+
+  sent = group_monotonic_us();
+  if (group_send(group, lengths) < 0) {
+    LATERO_LOG_EVERY(1000, LATERO_LOG_ERROR, "Packet sending error: %s", strerror(errno));
+    group_give_up(group, done, 0);
+    return(-1);
+  }
+
+  deadline = sent + group_timeout(group);
+  while (nb_done < (int)group->nb_devices) {
+    int64_t remaining = deadline - group_monotonic_us();
+    if (remaining < 0)
+      break;
+    rv = group_wait(group, remaining);
+    if (rv < 0 && errno != EINTR) {
+      LATERO_LOG_EVERY(1000, LATERO_LOG_ERROR, "Error waiting for responses: %s", strerror(errno));
+      group_give_up(group, done, 0);
+      return(-1);
+    }
+    if (rv <= 0)
+      continue;
+
+    nb_received = group_recv(group, lengths);
+    if (nb_received < 0) {
+      LATERO_LOG_EVERY(1000, LATERO_LOG_ERROR, "Error receiving response: %s", strerror(errno));
+      group_give_up(group, done, 0);
+      return(-1);
+    }
+    for (jj=0; jj<nb_received; jj++) {
+      int dev;
+      if (unpackPacket(group->rspbuff[jj], lengths[jj], &rpkt) < 0)
+        continue;
+      dev = group_match(group, &group->si_other[jj], &rpkt, done);
+      if (dev < 0)
+        continue;
+      done[dev] = 1;
+      nb_done++;
+      latero_complete_request(group->devices[dev], group->seq[dev], 1);
+      latero_update_rtt(group->devices[dev], group_monotonic_us() - sent);
+      if (responses)
+        responses[dev] = rpkt;
+    }
+  }
+
+  group_give_up(group, done, 1);
+  if (completed)
+    for (ii=0; ii<group->nb_devices; ii++)
+      completed[ii] = done[ii];
+  return(nb_done);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <netinet/in.h>
+#include "latero.h"
+
+// maximum number of devices driven by a group
+#define LATERO_GROUP_MAX_DEVICES 32
+
+/* Drives several Latero devices from a single socket and thread. Each device
+   keeps its state in its own latero_t, set with the usual SET functions, but
+   the packets of all devices are exchanged together: all requests go out in
+   one sendmmsg() call and responses are collected with recvmmsg() (on Linux;
+   one call per packet elsewhere). Elements of this structure should only be
+   modified by this API, not directly by the client.
+*/
+typedef struct
+{
+  int udp_socket;
+  unsigned int nb_devices;
+  latero_t* devices[LATERO_GROUP_MAX_DEVICES];
+  uint16_t seq[LATERO_GROUP_MAX_DEVICES]; // sequence number of the pending request of each device
+  char pktbuff[LATERO_GROUP_MAX_DEVICES][BUFLEN];
+  char rspbuff[LATERO_GROUP_MAX_DEVICES][BUFLEN];
+  struct sockaddr_in si_other[LATERO_GROUP_MAX_DEVICES];
+} latero_group_t;
+
+
+/*
+ * Create a group from connections opened with latero_open(). The connections
+ * remain owned by the caller and their sockets are left unused by the group.
+ * @return 0 on success, negative on failure
+ */
+int latero_group_open(latero_group_t* group, latero_t** devices, unsigned int nb_devices);
+
+
+/*
+ * Close the group (but not the connections of its devices).
+ * @return 0 on success, negative on failure
+ */
+int latero_group_close(latero_group_t* group);
+
+
+/**
+ * Write the currently set state of all devices and wait for their responses,
+ * for up to the longest response timeout of the devices (see latero_stats_t).
+ * A response is matched to its device by source address and sequence number.
+ * @param responses  array of nb_devices responses (optional, can be set to NULL)
+ * @param completed  array of nb_devices flags, set to 1 for each device that
+ *                   responded and 0 otherwise (optional, can be set to NULL)
+ * @return number of devices that responded, negative on failure
+ */
+int latero_group_write(latero_group_t* group, latero_pkt_t* responses, int* completed);
+
+#ifdef __cplusplus
+}
+#endif
@@ -9,83 +9,143 @@
 #include <unistd.h>
 
 #include "latero_io.h"
+#include "latero_log.h"
 
-void packPacket(char* pktbuff, unsigned int length, latero_pkt_t* pkt)
+/***** PRIVATE API *****/
+
+/*
+ * Big-endian loads and stores of count values at buf[pos], returning the
+ * position that follows. Values go through memcpy, which is safe at any
+ * alignment and compiles to plain (byte-swapping) loads and stores. With a
+ * constant count, the compiler unrolls and vectorizes the loops.
+ */
+
+static inline unsigned int put_U8(char* restrict buf, unsigned int pos, const void* restrict src, unsigned int count)
 {
-	int ii, pos;
-	uint16_t tmp;
-	uint32_t tmpl;
+    memcpy(&buf[pos], src, count);
+    return pos + count;
+}
 
-	if (length < sizeof (latero_pkt_t))
-		return;
+static inline unsigned int put_U16(char* restrict buf, unsigned int pos, const void* restrict src, unsigned int count)
+{
+    const uint16_t* v = (const uint16_t*) src;
+    unsigned int ii;
+    for (ii=0; ii<count; ii++) {
+        uint16_t tmp = htons(v[ii]);
+        memcpy(&buf[pos+2*ii], &tmp, sizeof(tmp));
+    }
+    return pos + 2*count;
+}
 
-    pktbuff[0] = pkt->hdr.magic;
-    pktbuff[1] = pkt->hdr.version;
-    pktbuff[2] = pkt->hdr.type;
-	tmp =  htons(*(uint16_t*)&(pkt->hdr.seq));
-	memcpy(&pktbuff[3], &tmp, sizeof(uint16_t));
+static inline unsigned int put_U32(char* restrict buf, unsigned int pos, const void* restrict src, unsigned int count)
+{
+    const uint32_t* v = (const uint32_t*) src;
+    unsigned int ii;
+    for (ii=0; ii<count; ii++) {
+        uint32_t tmp = htonl(v[ii]);
+        memcpy(&buf[pos+4*ii], &tmp, sizeof(tmp));
+    }
+    return pos + 4*count;
+}
 
-	pos = 5;
-	switch (pkt->hdr.type) {
-		case PKT_TYPE_FULL: case PKT_TYPE_IO:
-            tmp =  htons(*(uint16_t*)&(pkt->full.dio_out));
-            memcpy(&pktbuff[pos], &tmp, sizeof(uint16_t));pos+=2;
+static inline unsigned int get_U8(const char* restrict buf, unsigned int pos, void* restrict dst, unsigned int count)
+{
+    memcpy(dst, &buf[pos], count);
+    return pos + count;
+}
 
-			//pktbuff[pos] = pkt->full.dio_out; pos+=2;
+static inline unsigned int get_U16(const char* restrict buf, unsigned int pos, void* restrict dst, unsigned int count)
+{
+    uint16_t* v = (uint16_t*) dst;
+    unsigned int ii;
+    for (ii=0; ii<count; ii++) {
+        uint16_t tmp;
+        memcpy(&tmp, &buf[pos+2*ii], sizeof(tmp));
+        v[ii] = ntohs(tmp);
+    }
+    return pos + 2*count;
+}
 
-			for( ii = 0 ; ii < 4 ; ii++ ) {
-				tmp = htons(*(uint16_t*)&(pkt->full.dac[ii]));
-				memcpy(&pktbuff[pos+2*ii], &tmp, sizeof(uint16_t) );
-			}
-			pos = pos+2*ii;
-			for( ii = 0 ; ii < 64 ; ii++ ) {
-				pktbuff[pos+ii] = pkt->full.blade[ii];
-			}
-			break;
-		case PKT_TYPE_FULLR0: case PKT_TYPE_FULLR1:
-            tmp =  htons(*(uint16_t*)&(pkt->fullr.dio_in));
-            memcpy(&pktbuff[pos], &tmp, sizeof(uint16_t));pos+=2;
-			//pktbuff[pos] = pkt->fullr.dio_in; pos+=2;
+static inline unsigned int get_U32(const char* restrict buf, unsigned int pos, void* restrict dst, unsigned int count)
+{
+    uint32_t* v = (uint32_t*) dst;
+    unsigned int ii;
+    for (ii=0; ii<count; ii++) {
+        uint32_t tmp;
+        memcpy(&tmp, &buf[pos+4*ii], sizeof(tmp));
+        v[ii] = ntohl(tmp);
+    }
+    return pos + 4*count;
+}
 
-			tmp =  htons(*(uint16_t*)&(pkt->fullr.ctrlstatus));
-			memcpy(&pktbuff[pos], &tmp, sizeof(uint16_t));pos+=2;
-			tmp =  htons(*(uint16_t*)&(pkt->fullr.iostatus));
-			memcpy(&pktbuff[pos], &tmp, sizeof(uint16_t));pos+=2;
+#define PACK_FIELD(kind, member, count)   pos = put_##kind(buf, pos, &pkt->member, count);
+#define UNPACK_FIELD(kind, member, count) pos = get_##kind(buf, pos, &pkt->member, count);
+
+/* straight-line serializers of each packet type, generated from the layout tables */
+#define DEFINE_SERIALIZER(name, FIELDS) \
+    static inline void pack_##name(char* restrict buf, const latero_pkt_t* restrict pkt) \
+    { \
+        unsigned int pos = LATERO_HDR_LEN; \
+        FIELDS(PACK_FIELD) \
+        (void) pos; \
+    } \
+    static inline void unpack_##name(const char* restrict buf, latero_pkt_t* restrict pkt) \
+    { \
+        unsigned int pos = LATERO_HDR_LEN; \
+        FIELDS(UNPACK_FIELD) \
+        (void) pos; \
+    }
 
-			for( ii = 0 ; ii < 4 ; ii++ ) {
-				tmpl = htonl(*(uint32_t*)&(pkt->fullr.quad[ii]));
-				memcpy(&pktbuff[pos+sizeof(uint32_t)*ii], &tmpl, sizeof(uint32_t) );
-			}
-			pos = pos+sizeof(uint32_t)*ii;
-			for( ii = 0 ; ii < 4 ; ii++ ) {
-				tmp = htons(*(uint16_t*)&(pkt->fullr.adc[ii]));
-				memcpy(&pktbuff[pos+sizeof(uint16_t)*ii], &tmp, sizeof(uint16_t) );
-			}
-			break;
-		case PKT_TYPE_RAW:	case PKT_TYPE_RAWR:
-			pktbuff[pos] = pkt->raw.command; pos++;
-			tmp =  htons(*(uint16_t*)&(pkt->raw.address));
-			memcpy(&pktbuff[pos], &tmp, sizeof(uint16_t));pos+=2;
-			tmp =  htons(*(uint16_t*)&(pkt->raw.data));
-			memcpy(&pktbuff[pos], &tmp, sizeof(uint16_t));pos+=2;
-			break;
+DEFINE_SERIALIZER(full, LATERO_FULL_FIELDS)
+DEFINE_SERIALIZER(io, LATERO_IO_FIELDS)
+DEFINE_SERIALIZER(fullr, LATERO_FULLR_FIELDS)
+DEFINE_SERIALIZER(raw, LATERO_RAW_FIELDS)
+
+
+/***** PUBLIC API *****/
+
+unsigned int latero_pkt_len(uint8_t type)
+{
+	switch (type) {
+		case PKT_TYPE_FULL:   return LATERO_FULL_LEN;
+		case PKT_TYPE_IO:     return LATERO_IO_LEN;
+		case PKT_TYPE_FULLR0: case PKT_TYPE_FULLR1: return LATERO_FULLR_LEN;
+		case PKT_TYPE_RAW:    case PKT_TYPE_RAWR:   return LATERO_RAW_LEN;
+		default:              return 0;
 	}
 }
 
 
-int unpackPacket(char* buf, unsigned int length, latero_pkt_t* pkt)
+int packPacket(char* pktbuff, unsigned int length, latero_pkt_t* pkt)
 {
-	int ii, pos;
+	unsigned int len = latero_pkt_len(pkt->hdr.type);
+
+	if (len == 0 || length < len)
+		return(-1);
 
-    /* TODO Make this test more robust and based on actual received packet format
-            expected length. */
-	if (length < sizeof (latero_pkt_t)) { return(-1); }
+	pktbuff[0] = pkt->hdr.magic;
+	pktbuff[1] = pkt->hdr.version;
+	pktbuff[2] = pkt->hdr.type;
+	put_U16(pktbuff, 3, &pkt->hdr.seq, 1);
+
+	switch (pkt->hdr.type) {
+		case PKT_TYPE_FULL:   pack_full(pktbuff, pkt); break;
+		case PKT_TYPE_IO:     pack_io(pktbuff, pkt); break;
+		case PKT_TYPE_FULLR0: case PKT_TYPE_FULLR1: pack_fullr(pktbuff, pkt); break;
+		default:              pack_raw(pktbuff, pkt); break;
+	}
+	return(len);
+}
+
+
+int unpackPacket(char* buf, unsigned int length, latero_pkt_t* pkt)
+{
+	if (length < LATERO_HDR_LEN) { return(-1); }
 
 	pkt->hdr.magic      = buf[0];
 	pkt->hdr.version    = buf[1];
 	pkt->hdr.type       = buf[2];
-	pkt->hdr.seq        = ntohs(*(uint16_t*)(&buf[3]));
-	pos = 5;
+	get_U16(buf, 3, &pkt->hdr.seq, 1);
 
     /* Some basic sanity in case we receive another type of UDP packet */
     /* Avoid crash and burn... */
@@ -94,48 +154,26 @@ int unpackPacket(char* buf, unsigned int length, latero_pkt_t* pkt)
     }
 
 	switch (pkt->hdr.type) {
-
 		case PKT_TYPE_FULL:
-        case PKT_TYPE_IO:
-			/* printf("Packet Type Full or IO\n"); */
-			pkt->full.dio_out = buf[pos]; pos+=2;
-			for( ii = 0 ; ii < 4 ; ii++ ) {
-				pkt->full.dac[ii] = ntohs(*(uint16_t*)(&buf[pos+2*ii]));
-			}
-			pos = pos+2*ii;
-			if (pkt->hdr.type == PKT_TYPE_FULL) {
-				for( ii = 0 ; ii < 64 ; ii++ ) {
-					pkt->full.blade[ii] = buf[pos+ii];
-				}
-			}
+			if (length < LATERO_FULL_LEN) return(-1);
+			unpack_full(buf, pkt);
+			break;
+		case PKT_TYPE_IO:
+			if (length < LATERO_IO_LEN) return(-1);
+			unpack_io(buf, pkt);
 			break;
-
 		case PKT_TYPE_RAW:
-        case PKT_TYPE_RAWR:
-			/* printf("Packet Type Raw \n"); */
-			pkt->raw.command = buf[pos]; pos++;
-			pkt->raw.address = ntohs(*(uint16_t*)(&buf[pos])); pos+=2;
-			pkt->raw.data    = ntohs(*(uint16_t*)(&buf[pos])); pos+=2;
+		case PKT_TYPE_RAWR:
+			if (length < LATERO_RAW_LEN) return(-1);
+			unpack_raw(buf, pkt);
 			break;
-
 		case PKT_TYPE_FULLR0:
-        case PKT_TYPE_FULLR1:
-			/*printf("Packet Type Full Response \n");*/
-
-			pkt->fullr.dio_in = ntohs(*(uint16_t*)(&buf[pos])); pos+=2;
-			pkt->fullr.ctrlstatus = ntohs(*(uint16_t*)(&buf[pos])); pos+=2;
-			pkt->fullr.iostatus   = ntohs(*(uint16_t*)(&buf[pos])); pos+=2;
-
-			for( ii = 0 ; ii < 4 ; ii++ ) {
-				pkt->fullr.quad[ii] = ntohl(*(uint32_t*)(&buf[pos+sizeof(uint32_t)*ii]));
-			}
-			pos = pos+sizeof(uint32_t)*ii;
-			for( ii = 0 ; ii < 4 ; ii++ ) {
-				pkt->fullr.adc[ii] = ntohs(*(uint16_t*)(&buf[pos+sizeof(uint16_t)*ii]));
-			}
+		case PKT_TYPE_FULLR1:
+			if (length < LATERO_FULLR_LEN) return(-1);
+			unpack_fullr(buf, pkt);
 			break;
         default:
-            printf("Unknown packet type!!!\n");
+            LATERO_LOG_EVERY(1000, LATERO_LOG_WARNING, "Unknown packet type 0x%2.2X", buf[2] & 0xFF);
             return(-2);
 	}
     return(0);
@@ -10,6 +10,8 @@ extern "C" {
 #define LATERO_MAGIC_NB 0xCA
 
 /* Latero packet types */
+#define PKT_TYPE_NONE 0x00 /* no packet (e.g. no response received yet) */
+
 /* Request Packets*/
 #define PKT_TYPE_FULL 0x01
 #define PKT_TYPE_IO   0x02
@@ -30,6 +32,53 @@ extern "C" {
 #define PKT_RAW_CMD_IO   0x20
 
 #define BUFLEN 100
+
+/*
+ * Wire layout of the packet types, after the 5-byte header (magic, version,
+ * type, seq). Each entry is FIELD(kind, member of latero_pkt_t, count), where
+ * kind is U8, U16 or U32. Multi-byte values are in network byte order. The
+ * serializer in latero_io.c and the packet lengths below are generated from
+ * these tables.
+ */
+#define LATERO_FULL_FIELDS(FIELD) \
+    FIELD(U16, full.dio_out, 1)    \
+    FIELD(U16, full.dac, 4)        \
+    FIELD(U8,  full.blade, 64)
+
+#define LATERO_IO_FIELDS(FIELD) \
+    FIELD(U16, full.dio_out, 1)  \
+    FIELD(U16, full.dac, 4)
+
+#define LATERO_FULLR_FIELDS(FIELD) \
+    FIELD(U16, fullr.dio_in, 1)     \
+    FIELD(U16, fullr.ctrlstatus, 1) \
+    FIELD(U16, fullr.iostatus, 1)   \
+    FIELD(U32, fullr.quad, 4)       \
+    FIELD(U16, fullr.adc, 4)
+
+#define LATERO_RAW_FIELDS(FIELD) \
+    FIELD(U8,  raw.command, 1)    \
+    FIELD(U16, raw.address, 1)    \
+    FIELD(U16, raw.data, 1)
+
+#define LATERO_SIZE_U8  1
+#define LATERO_SIZE_U16 2
+#define LATERO_SIZE_U32 4
+#define LATERO_FIELD_SIZE(kind, member, count) + (count)*LATERO_SIZE_##kind
+
+/* Exact length on the wire of each packet type */
+#define LATERO_HDR_LEN   5
+#define LATERO_FULL_LEN  (LATERO_HDR_LEN LATERO_FULL_FIELDS(LATERO_FIELD_SIZE))
+#define LATERO_IO_LEN    (LATERO_HDR_LEN LATERO_IO_FIELDS(LATERO_FIELD_SIZE))
+#define LATERO_FULLR_LEN (LATERO_HDR_LEN LATERO_FULLR_FIELDS(LATERO_FIELD_SIZE))
+#define LATERO_RAW_LEN   (LATERO_HDR_LEN LATERO_RAW_FIELDS(LATERO_FIELD_SIZE))
+
+/* offsets of the fields that are patched in place in an encoded packet */
+#define LATERO_TYPE_OFFSET       2
+#define LATERO_SEQ_OFFSET        3
+#define LATERO_FULL_DIO_OFFSET   LATERO_HDR_LEN
+#define LATERO_FULL_DAC_OFFSET   (LATERO_HDR_LEN + 2)
+#define LATERO_FULL_BLADE_OFFSET (LATERO_FULL_LEN - 64)
 /* #define UDP_ADDR "127.0.0.1" */
 
 #define LATERO_EXPAN_DIO       0x10 /* Read = DIN, Write = DOUT */
@@ -75,8 +124,21 @@ typedef struct {
 } latero_pkt_t;
 
 
-void packPacket(char* pktbuff, unsigned int length, latero_pkt_t* pkt);
+/**
+ * @return length on the wire of a packet of the given type, 0 if the type is unknown
+ */
+unsigned int latero_pkt_len(uint8_t type);
+
+/**
+ * Serialize a packet at its exact length.
+ * @return length of the packet, negative if the buffer is too small or the type unknown
+ */
+int packPacket(char* pktbuff, unsigned int length, latero_pkt_t* pkt);
 
+/**
+ * Deserialize a packet. Trailing bytes beyond the length of the packet type are ignored.
+ * @return 0 on success, -1 if the packet is invalid or truncated, -2 if its type is unknown
+ */
 int unpackPacket(char* buf, unsigned int length, latero_pkt_t* pkt);
 
 
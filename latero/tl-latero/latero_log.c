@@ -0,0 +1,210 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "latero_log.h"
+
+// interval at which the background thread drains the ring [ms]
+#define DRAIN_INTERVAL_MS 10
+
+#define RING_MASK (LATERO_LOG_CAPACITY - 1)
+
+#if (LATERO_LOG_CAPACITY & RING_MASK) != 0
+#error LATERO_LOG_CAPACITY must be a power of two
+#endif
+
+/*
+ * Bounded multi-producer ring. Each slot carries a marker telling which lap of
+ * the ring it is in: lap*CAPACITY when free for the lap, lap*CAPACITY + 1 once
+ * written. Producers claim a position by advancing enqueue_pos, then publish
+ * the slot by setting its marker; the consumer frees it by moving the marker to
+ * the next lap. All markers start at 0, so the ring needs no initialization.
+ */
+typedef struct
+{
+  unsigned long marker;
+  latero_log_level level;
+  char text[LATERO_LOG_MSG_LEN];
+} log_slot_t;
+
+static log_slot_t ring[LATERO_LOG_CAPACITY];
+static unsigned long enqueue_pos;
+static unsigned long dequeue_pos;   // only touched by the consumer, under consumer_lock
+static unsigned long dropped;
+static int level = LATERO_LOG_INFO;
+
+static pthread_mutex_t consumer_lock = PTHREAD_MUTEX_INITIALIZER;
+static latero_log_sink sink;        // under consumer_lock
+static void* sink_user;
+static pthread_once_t started = PTHREAD_ONCE_INIT;
+
+
+/***** PRIVATE API *****/
+
+static int64_t log_monotonic_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static void log_write_stderr(latero_log_level lvl, const char* message)
+{
+  static const char* names[] = { "debug", "info", "warning", "error" };
+  fprintf(stderr, "latero: %s: %s\n", names[lvl], message);
+}
+
+
+/** Write the messages published so far. */
+static void log_drain(void)
+{
+  static unsigned long reported; // dropped messages already reported
+  unsigned long nb_dropped;
+  log_slot_t slot;
+
+  pthread_mutex_lock(&consumer_lock);
+  while (1) {
+    log_slot_t* s = &ring[dequeue_pos & RING_MASK];
+    unsigned long lap = dequeue_pos & ~(unsigned long)RING_MASK;
+    if (__atomic_load_n(&s->marker, __ATOMIC_ACQUIRE) != lap + 1)
+      break;
+    slot = *s;
+    __atomic_store_n(&s->marker, lap + LATERO_LOG_CAPACITY, __ATOMIC_RELEASE);
+    dequeue_pos++;
+
+    if (sink)
+      sink(slot.level, slot.text, sink_user);
+    else
+      log_write_stderr(slot.level, slot.text);
+  }
+
+  nb_dropped = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+  if (nb_dropped != reported) {
+    char text[LATERO_LOG_MSG_LEN];
+    snprintf(text, sizeof(text), "%lu messages dropped (log ring full)", nb_dropped - reported);
+    if (sink)
+      sink(LATERO_LOG_WARNING, text, sink_user);
+    else
+      log_write_stderr(LATERO_LOG_WARNING, text);
+    reported = nb_dropped;
+  }
+  pthread_mutex_unlock(&consumer_lock);
+}
+
+
+static void* log_thread(void* arg)
+{
+  struct timespec interval;
+
+  (void) arg;
+  interval.tv_sec = 0;
+  interval.tv_nsec = DRAIN_INTERVAL_MS * 1000000L;
+  while (1) {
+    log_drain();
+    nanosleep(&interval, NULL);
+  }
+  return NULL;
+}
+
+
+static void log_start(void)
+{
+  pthread_t thread;
+  pthread_attr_t attr;
+
+  atexit(log_drain);
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  pthread_create(&thread, &attr, log_thread, NULL);
+  pthread_attr_destroy(&attr);
+}
+
+
+/***** PUBLIC API *****/
+
+void latero_log(latero_log_level lvl, const char* format, ...)
+{
+  unsigned long pos, lap;
+  log_slot_t* s;
+  va_list args;
+
+  if ((int)lvl < __atomic_load_n(&level, __ATOMIC_RELAXED) || lvl >= LATERO_LOG_NONE)
+    return;
+  pthread_once(&started, log_start);
+
+  /* claim a slot, or give up if the ring is full */
+  pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+  while (1) {
+    long diff;
+    s = &ring[pos & RING_MASK];
+    lap = pos & ~(unsigned long)RING_MASK;
+    diff = (long)(__atomic_load_n(&s->marker, __ATOMIC_ACQUIRE) - lap);
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    } else if (diff < 0) {
+      __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+      return;
+    } else {
+      pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+    }
+  }
+
+  s->level = lvl;
+  va_start(args, format);
+  vsnprintf(s->text, sizeof(s->text), format, args);
+  va_end(args);
+  __atomic_store_n(&s->marker, lap + 1, __ATOMIC_RELEASE);
+}
+
+
+int latero_log_allow(latero_log_limit_t* limit, int interval_ms, unsigned long* suppressed)
+{
+  int64_t now = log_monotonic_us();
+  int64_t next = __atomic_load_n(&limit->next_us, __ATOMIC_RELAXED);
+
+  if (now < next || !__atomic_compare_exchange_n(&limit->next_us, &next, now + (int64_t)interval_ms * 1000,
+                                                 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    __atomic_fetch_add(&limit->suppressed, 1, __ATOMIC_RELAXED);
+    return(0);
+  }
+  *suppressed = __atomic_exchange_n(&limit->suppressed, 0, __ATOMIC_RELAXED);
+  return(1);
+}
+
+
+void latero_log_set_level(latero_log_level lvl)
+{
+  __atomic_store_n(&level, (int)lvl, __ATOMIC_RELAXED);
+}
+
+
+latero_log_level latero_log_get_level(void)
+{
+  return (latero_log_level) __atomic_load_n(&level, __ATOMIC_RELAXED);
+}
+
+
+void latero_log_set_sink(latero_log_sink new_sink, void* user)
+{
+  pthread_mutex_lock(&consumer_lock);
+  sink = new_sink;
+  sink_user = user;
+  pthread_mutex_unlock(&consumer_lock);
+}
+
+
+void latero_log_flush(void)
+{
+  log_drain();
+}
+
+
+unsigned long latero_log_dropped(void)
+{
+  return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// maximum length of a message, including the terminating null character
+#define LATERO_LOG_MSG_LEN 120
+
+// number of messages that can wait to be written
+#define LATERO_LOG_CAPACITY 256
+
+/**
+ * Severity of a message. Messages below the level set with latero_log_set_level()
+ * are discarded.
+ */
+typedef enum
+{
+  LATERO_LOG_DEBUG,
+  LATERO_LOG_INFO,
+  LATERO_LOG_WARNING,
+  LATERO_LOG_ERROR,
+  LATERO_LOG_NONE    // as a level: discard all messages
+} latero_log_level;
+
+/**
+ * Receives messages from the background thread.
+ * @param user  as given to latero_log_set_sink()
+ */
+typedef void (*latero_log_sink)(latero_log_level level, const char* message, void* user);
+
+/* State of a rate-limited call site, see LATERO_LOG_EVERY. */
+typedef struct
+{
+  int64_t next_us;          // monotonic time after which the next message is let through [us]
+  unsigned long suppressed; // messages suppressed since the last one let through
+} latero_log_limit_t;
+
+/*
+ * Diagnostics of the driver are written by a background thread, so that
+ * logging never blocks the frame loop. latero_log() formats the message into
+ * a lock-free ring buffer shared by all threads; if the ring is full, the
+ * message is dropped (and counted) rather than waited for. The thread starts
+ * with the first message and drains the ring every few milliseconds, and
+ * pending messages are written when the program exits.
+ */
+
+/**
+ * Log a message (printf-style). Safe to call from any thread, never blocks.
+ */
+void latero_log(latero_log_level level, const char* format, ...)
+#if defined(__GNUC__)
+  __attribute__((format(printf, 2, 3)))
+#endif
+  ;
+
+/**
+ * Log a message at most once every interval_ms per call site, prefixed with the
+ * number of messages suppressed in between. For messages that can repeat at the
+ * frame rate under fault conditions.
+ */
+#define LATERO_LOG_EVERY(interval_ms, level, ...)                          \
+  do {                                                                    \
+    static latero_log_limit_t latero_log_limit_;                          \
+    unsigned long latero_log_suppressed_;                                 \
+    if (latero_log_allow(&latero_log_limit_, (interval_ms), &latero_log_suppressed_)) { \
+      if (latero_log_suppressed_)                                         \
+        latero_log((level), "(%lu similar messages suppressed)", latero_log_suppressed_); \
+      latero_log((level), __VA_ARGS__);                                   \
+    }                                                                     \
+  } while (0)
+
+/**
+ * Rate limit of LATERO_LOG_EVERY.
+ * @param suppressed  set to the number of messages suppressed since the last one let through
+ * @return 1 if the message should be logged, 0 otherwise
+ */
+int latero_log_allow(latero_log_limit_t* limit, int interval_ms, unsigned long* suppressed);
+
+/** Discard messages below level (default: LATERO_LOG_INFO). */
+void latero_log_set_level(latero_log_level level);
+
+/** @return current level */
+latero_log_level latero_log_get_level(void);
+
+/**
+ * Send messages to a function instead of stderr. The sink is called from the
+ * background thread (or from latero_log_flush()).
+ * @param sink  NULL to restore the default (stderr)
+ */
+void latero_log_set_sink(latero_log_sink sink, void* user);
+
+/** Write the pending messages before returning. */
+void latero_log_flush(void);
+
+/** @return number of messages dropped because the ring was full */
+unsigned long latero_log_dropped(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,553 @@
+#include "latero.h"
+#include "latero_quantize.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define QUANTIZE_X86
+#include <immintrin.h>
+#endif
+
+typedef void (*quantize_fn)(const double* from, const double* to, double ratio, uint8_t* raw, int n);
+typedef void (*quantize_f32_fn)(const float* from, const float* to, float ratio, float range, uint8_t* raw, int n);
+typedef void (*quantize_mix_fn)(const float* from, const float* to, const float* ratio, float range, uint8_t* raw, int n);
+typedef void (*quantize_f32_calib_fn)(const float* from, const float* to, float ratio, const latero_calib_t* calib, uint8_t* raw, int n);
+typedef void (*quantize_mix_calib_fn)(const float* from, const float* to, const float* ratio, const latero_calib_t* calib, uint8_t* raw, int n);
+
+/* versions of the floating point kernels for an instruction set */
+typedef struct
+{
+  quantize_fn f64;
+  quantize_f32_fn f32;
+  quantize_mix_fn mix;
+  quantize_f32_calib_fn f32_calib;
+  quantize_mix_calib_fn mix_calib;
+} quantize_kernels_t;
+
+static const quantize_kernels_t* quantize_impl; // selected at the first call
+static latero_isa quantize_isa;
+
+
+/***** PRIVATE API *****/
+
+/*
+ * All versions compute the same operations in the same order, without fused
+ * multiply-adds, so that they round alike. The single precision kernels scale
+ * values to [0, range], with range LATERO_MAX_RAW_PIN for raw values. The
+ * calibrated kernels index the tables at CALIB_HALF + CALIB_HALF * x, the same
+ * scale folded into one multiply-add.
+ */
+
+#define CALIB_HALF (0.5f * (LATERO_CALIB_SIZE - 1))
+
+static inline uint8_t quantize_one(double from, double to, double ratio)
+{
+  double x = from * (1.0 - ratio) + to * ratio;
+  x = (x > -1.0) ? x : -1.0; // NaN compares false
+  x = (x < 1.0) ? x : 1.0;
+  return (uint8_t) ((0.5 + 0.5 * x) * LATERO_MAX_RAW_PIN);
+}
+
+
+static inline uint8_t quantize_one_f32(float from, float to, float ratio, float range)
+{
+  float x = from * (1.0f - ratio) + to * ratio;
+  x = (x > -1.0f) ? x : -1.0f;
+  x = (x < 1.0f) ? x : 1.0f;
+  return (uint8_t) ((0.5f + 0.5f * x) * range);
+}
+
+
+static inline int calib_index(float from, float to, float ratio)
+{
+  float x = from * (1.0f - ratio) + to * ratio;
+  x = (x > -1.0f) ? x : -1.0f;
+  x = (x < 1.0f) ? x : 1.0f;
+  return (int) (CALIB_HALF + CALIB_HALF * x);
+}
+
+
+static void quantize_scalar(const double* from, const double* to, double ratio, uint8_t* raw, int n)
+{
+  int i;
+  for (i=0; i<n; ++i)
+    raw[i] = quantize_one(from[i], to[i], ratio);
+}
+
+
+static void quantize_scalar_f32(const float* from, const float* to, float ratio, float range, uint8_t* raw, int n)
+{
+  int i;
+  for (i=0; i<n; ++i)
+    raw[i] = quantize_one_f32(from[i], to[i], ratio, range);
+}
+
+
+static void quantize_scalar_mix(const float* from, const float* to, const float* ratio, float range, uint8_t* raw, int n)
+{
+  int i;
+  for (i=0; i<n; ++i)
+    raw[i] = quantize_one_f32(from[i], to[i], ratio[i], range);
+}
+
+
+static void quantize_scalar_f32_calib(const float* from, const float* to, float ratio, const latero_calib_t* calib, uint8_t* raw, int n)
+{
+  int i;
+  for (i=0; i<n; ++i)
+    raw[i] = calib->table[i][calib_index(from[i], to[i], ratio)];
+}
+
+
+static void quantize_scalar_mix_calib(const float* from, const float* to, const float* ratio, const latero_calib_t* calib, uint8_t* raw, int n)
+{
+  int i;
+  for (i=0; i<n; ++i)
+    raw[i] = calib->table[i][calib_index(from[i], to[i], ratio[i])];
+}
+
+static const quantize_kernels_t quantize_scalar_kernels = {
+  quantize_scalar, quantize_scalar_f32, quantize_scalar_mix, quantize_scalar_f32_calib, quantize_scalar_mix_calib
+};
+
+
+#ifdef QUANTIZE_X86
+
+/* max(x, -1) returns its second operand when x is NaN */
+#define QUANTIZE_SSE2_STEP(x)                                              \
+  _mm_cvttpd_epi32(_mm_mul_pd(_mm_add_pd(half, _mm_mul_pd(half,          \
+    _mm_min_pd(_mm_max_pd((x), minus_one), one))), scale))
+
+__attribute__((target("sse2")))
+static void quantize_sse2(const double* from, const double* to, double ratio, uint8_t* raw, int n)
+{
+  const __m128d keep = _mm_set1_pd(1.0 - ratio), take = _mm_set1_pd(ratio);
+  const __m128d minus_one = _mm_set1_pd(-1.0), one = _mm_set1_pd(1.0);
+  const __m128d half = _mm_set1_pd(0.5), scale = _mm_set1_pd(LATERO_MAX_RAW_PIN);
+  int i, j;
+
+  for (i=0; i+16<=n; i+=16) {
+    __m128i q[4];
+    for (j=0; j<4; ++j) {
+      const double* f = from + i + 4*j;
+      const double* t = to + i + 4*j;
+      __m128d x0 = _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(f), keep), _mm_mul_pd(_mm_loadu_pd(t), take));
+      __m128d x1 = _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(f+2), keep), _mm_mul_pd(_mm_loadu_pd(t+2), take));
+      q[j] = _mm_unpacklo_epi64(QUANTIZE_SSE2_STEP(x0), QUANTIZE_SSE2_STEP(x1));
+    }
+    /* 16 values in [0, LATERO_MAX_RAW_PIN]: no saturation happens */
+    _mm_storeu_si128((__m128i*) (raw + i),
+                     _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3])));
+  }
+  for (; i<n; ++i)
+    raw[i] = quantize_one(from[i], to[i], ratio);
+}
+
+
+__attribute__((target("sse2")))
+static void quantize_sse2_f32(const float* from, const float* to, float ratio, float range, uint8_t* raw, int n)
+{
+  const __m128 keep = _mm_set1_ps(1.0f - ratio), take = _mm_set1_ps(ratio);
+  const __m128 minus_one = _mm_set1_ps(-1.0f), one = _mm_set1_ps(1.0f);
+  const __m128 half = _mm_set1_ps(0.5f), scale = _mm_set1_ps(range);
+  int i, j;
+
+  for (i=0; i+16<=n; i+=16) {
+    __m128i q[4];
+    for (j=0; j<4; ++j) {
+      __m128 x = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(from + i + 4*j), keep),
+                            _mm_mul_ps(_mm_loadu_ps(to + i + 4*j), take));
+      x = _mm_min_ps(_mm_max_ps(x, minus_one), one);
+      q[j] = _mm_cvttps_epi32(_mm_mul_ps(_mm_add_ps(half, _mm_mul_ps(half, x)), scale));
+    }
+    _mm_storeu_si128((__m128i*) (raw + i),
+                     _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3])));
+  }
+  for (; i<n; ++i)
+    raw[i] = quantize_one_f32(from[i], to[i], ratio, range);
+}
+
+
+__attribute__((target("sse2")))
+static void quantize_sse2_mix(const float* from, const float* to, const float* ratio, float range, uint8_t* raw, int n)
+{
+  const __m128 minus_one = _mm_set1_ps(-1.0f), one = _mm_set1_ps(1.0f);
+  const __m128 half = _mm_set1_ps(0.5f), scale = _mm_set1_ps(range);
+  int i, j;
+
+  for (i=0; i+16<=n; i+=16) {
+    __m128i q[4];
+    for (j=0; j<4; ++j) {
+      __m128 take = _mm_loadu_ps(ratio + i + 4*j);
+      __m128 x = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(from + i + 4*j), _mm_sub_ps(one, take)),
+                            _mm_mul_ps(_mm_loadu_ps(to + i + 4*j), take));
+      x = _mm_min_ps(_mm_max_ps(x, minus_one), one);
+      q[j] = _mm_cvttps_epi32(_mm_mul_ps(_mm_add_ps(half, _mm_mul_ps(half, x)), scale));
+    }
+    _mm_storeu_si128((__m128i*) (raw + i),
+                     _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3])));
+  }
+  for (; i<n; ++i)
+    raw[i] = quantize_one_f32(from[i], to[i], ratio[i], range);
+}
+
+
+/* SSE2 has no gather: the indices of 16 pins are computed together, then looked up one pin at a time */
+__attribute__((target("sse2")))
+static void quantize_sse2_f32_calib(const float* from, const float* to, float ratio, const latero_calib_t* calib, uint8_t* raw, int n)
+{
+  const __m128 keep = _mm_set1_ps(1.0f - ratio), take = _mm_set1_ps(ratio);
+  const __m128 minus_one = _mm_set1_ps(-1.0f), one = _mm_set1_ps(1.0f);
+  const __m128 half = _mm_set1_ps(CALIB_HALF);
+  uint8_t index[16];
+  int i, j;
+
+  for (i=0; i+16<=n; i+=16) {
+    __m128i q[4];
+    for (j=0; j<4; ++j) {
+      __m128 x = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(from + i + 4*j), keep),
+                            _mm_mul_ps(_mm_loadu_ps(to + i + 4*j), take));
+      x = _mm_min_ps(_mm_max_ps(x, minus_one), one);
+      q[j] = _mm_cvttps_epi32(_mm_add_ps(half, _mm_mul_ps(half, x)));
+    }
+    _mm_storeu_si128((__m128i*) index,
+                     _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3])));
+    for (j=0; j<16; ++j)
+      raw[i+j] = calib->table[i+j][index[j]];
+  }
+  for (; i<n; ++i)
+    raw[i] = calib->table[i][calib_index(from[i], to[i], ratio)];
+}
+
+
+__attribute__((target("sse2")))
+static void quantize_sse2_mix_calib(const float* from, const float* to, const float* ratio, const latero_calib_t* calib, uint8_t* raw, int n)
+{
+  const __m128 minus_one = _mm_set1_ps(-1.0f), one = _mm_set1_ps(1.0f);
+  const __m128 half = _mm_set1_ps(CALIB_HALF);
+  uint8_t index[16];
+  int i, j;
+
+  for (i=0; i+16<=n; i+=16) {
+    __m128i q[4];
+    for (j=0; j<4; ++j) {
+      __m128 take = _mm_loadu_ps(ratio + i + 4*j);
+      __m128 x = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(from + i + 4*j), _mm_sub_ps(one, take)),
+                            _mm_mul_ps(_mm_loadu_ps(to + i + 4*j), take));
+      x = _mm_min_ps(_mm_max_ps(x, minus_one), one);
+      q[j] = _mm_cvttps_epi32(_mm_add_ps(half, _mm_mul_ps(half, x)));
+    }
+    _mm_storeu_si128((__m128i*) index,
+                     _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3])));
+    for (j=0; j<16; ++j)
+      raw[i+j] = calib->table[i+j][index[j]];
+  }
+  for (; i<n; ++i)
+    raw[i] = calib->table[i][calib_index(from[i], to[i], ratio[i])];
+}
+
+static const quantize_kernels_t quantize_sse2_kernels = {
+  quantize_sse2, quantize_sse2_f32, quantize_sse2_mix, quantize_sse2_f32_calib, quantize_sse2_mix_calib
+};
+
+
+__attribute__((target("avx2")))
+static void quantize_avx2(const double* from, const double* to, double ratio, uint8_t* raw, int n)
+{
+  const __m256d keep = _mm256_set1_pd(1.0 - ratio), take = _mm256_set1_pd(ratio);
+  const __m256d minus_one = _mm256_set1_pd(-1.0), one = _mm256_set1_pd(1.0);
+  const __m256d half = _mm256_set1_pd(0.5), scale = _mm256_set1_pd(LATERO_MAX_RAW_PIN);
+  int i, j;
+
+  for (i=0; i+16<=n; i+=16) {
+    __m128i q[4];
+    for (j=0; j<4; ++j) {
+      __m256d x = _mm256_add_pd(_mm256_mul_pd(_mm256_loadu_pd(from + i + 4*j), keep),
+                                _mm256_mul_pd(_mm256_loadu_pd(to + i + 4*j), take));
+      x = _mm256_min_pd(_mm256_max_pd(x, minus_one), one);
+      q[j] = _mm256_cvttpd_epi32(_mm256_mul_pd(_mm256_add_pd(half, _mm256_mul_pd(half, x)), scale));
+    }
+    _mm_storeu_si128((__m128i*) (raw + i),
+                     _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3])));
+  }
+  for (; i<n; ++i)
+    raw[i] = quantize_one(from[i], to[i], ratio);
+}
+
+
+__attribute__((target("avx2")))
+static void quantize_avx2_f32(const float* from, const float* to, float ratio, float range, uint8_t* raw, int n)
+{
+  const __m256 keep = _mm256_set1_ps(1.0f - ratio), take = _mm256_set1_ps(ratio);
+  const __m256 minus_one = _mm256_set1_ps(-1.0f), one = _mm256_set1_ps(1.0f);
+  const __m256 half = _mm256_set1_ps(0.5f), scale = _mm256_set1_ps(range);
+  int i, j;
+
+  for (i=0; i+16<=n; i+=16) {
+    __m256i q[2];
+    for (j=0; j<2; ++j) {
+      __m256 x = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(from + i + 8*j), keep),
+                               _mm256_mul_ps(_mm256_loadu_ps(to + i + 8*j), take));
+      x = _mm256_min_ps(_mm256_max_ps(x, minus_one), one);
+      q[j] = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_add_ps(half, _mm256_mul_ps(half, x)), scale));
+    }
+    _mm_storeu_si128((__m128i*) (raw + i),
+                     _mm_packus_epi16(_mm_packs_epi32(_mm256_castsi256_si128(q[0]), _mm256_extracti128_si256(q[0], 1)),
+                                      _mm_packs_epi32(_mm256_castsi256_si128(q[1]), _mm256_extracti128_si256(q[1], 1))));
+  }
+  for (; i<n; ++i)
+    raw[i] = quantize_one_f32(from[i], to[i], ratio, range);
+}
+
+
+__attribute__((target("avx2")))
+static void quantize_avx2_mix(const float* from, const float* to, const float* ratio, float range, uint8_t* raw, int n)
+{
+  const __m256 minus_one = _mm256_set1_ps(-1.0f), one = _mm256_set1_ps(1.0f);
+  const __m256 half = _mm256_set1_ps(0.5f), scale = _mm256_set1_ps(range);
+  int i, j;
+
+  for (i=0; i+16<=n; i+=16) {
+    __m256i q[2];
+    for (j=0; j<2; ++j) {
+      __m256 take = _mm256_loadu_ps(ratio + i + 8*j);
+      __m256 x = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(from + i + 8*j), _mm256_sub_ps(one, take)),
+                               _mm256_mul_ps(_mm256_loadu_ps(to + i + 8*j), take));
+      x = _mm256_min_ps(_mm256_max_ps(x, minus_one), one);
+      q[j] = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_add_ps(half, _mm256_mul_ps(half, x)), scale));
+    }
+    _mm_storeu_si128((__m128i*) (raw + i),
+                     _mm_packus_epi16(_mm_packs_epi32(_mm256_castsi256_si128(q[0]), _mm256_extracti128_si256(q[0], 1)),
+                                      _mm_packs_epi32(_mm256_castsi256_si128(q[1]), _mm256_extracti128_si256(q[1], 1))));
+  }
+  for (; i<n; ++i)
+    raw[i] = quantize_one_f32(from[i], to[i], ratio[i], range);
+}
+
+/*
+ * Calibrated kernels: the raw values of 8 pins are read by a single gather of
+ * 32-bit words, at byte offsets pin*LATERO_CALIB_SIZE + index (the padding of
+ * latero_calib_t covers the bytes read past the last table). A byte shuffle
+ * moves their low bytes to the place of the pins in each 128-bit lane, so that
+ * 16 pins are merged by ORs. The shuffle cannot do the lookup itself: it
+ * applies the same 16 bytes to every lane, and each pin has a table of its own.
+ */
+#define QUANTIZE_AVX2_CALIB_STEP(x, j)                                          \
+  _mm256_shuffle_epi8(_mm256_i32gather_epi32((const int*) calib->table[0],     \
+    _mm256_add_epi32(_mm256_cvttps_epi32(_mm256_add_ps(half, _mm256_mul_ps(half, \
+      _mm256_min_ps(_mm256_max_ps((x), minus_one), one)))), offsets[j]), 1), low_bytes[j])
+
+__attribute__((target("avx2")))
+static void quantize_avx2_f32_calib(const float* from, const float* to, float ratio, const latero_calib_t* calib, uint8_t* raw, int n)
+{
+  const __m256 keep = _mm256_set1_ps(1.0f - ratio), take = _mm256_set1_ps(ratio);
+  const __m256 minus_one = _mm256_set1_ps(-1.0f), one = _mm256_set1_ps(1.0f);
+  const __m256 half = _mm256_set1_ps(CALIB_HALF);
+  const __m256i step = _mm256_set1_epi32(16*LATERO_CALIB_SIZE);
+  const __m256i low_bytes[2] = {
+    _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                     -1, -1, -1, -1, 0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1),
+    _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 0, 4, 8, 12, -1, -1, -1, -1,
+                     -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 4, 8, 12)
+  };
+  __m256i offsets[2];
+  int i, j;
+
+  offsets[0] = _mm256_setr_epi32(0, LATERO_CALIB_SIZE, 2*LATERO_CALIB_SIZE, 3*LATERO_CALIB_SIZE,
+                                 4*LATERO_CALIB_SIZE, 5*LATERO_CALIB_SIZE, 6*LATERO_CALIB_SIZE, 7*LATERO_CALIB_SIZE);
+  offsets[1] = _mm256_add_epi32(offsets[0], _mm256_set1_epi32(8*LATERO_CALIB_SIZE));
+
+  for (i=0; i+16<=n; i+=16) {
+    __m256i q = _mm256_setzero_si256();
+    for (j=0; j<2; ++j) {
+      __m256 x = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(from + i + 8*j), keep),
+                               _mm256_mul_ps(_mm256_loadu_ps(to + i + 8*j), take));
+      q = _mm256_or_si256(q, QUANTIZE_AVX2_CALIB_STEP(x, j));
+      offsets[j] = _mm256_add_epi32(offsets[j], step);
+    }
+    _mm_storeu_si128((__m128i*) (raw + i), _mm_or_si128(_mm256_castsi256_si128(q), _mm256_extracti128_si256(q, 1)));
+  }
+  for (; i<n; ++i)
+    raw[i] = calib->table[i][calib_index(from[i], to[i], ratio)];
+}
+
+
+__attribute__((target("avx2")))
+static void quantize_avx2_mix_calib(const float* from, const float* to, const float* ratio, const latero_calib_t* calib, uint8_t* raw, int n)
+{
+  const __m256 minus_one = _mm256_set1_ps(-1.0f), one = _mm256_set1_ps(1.0f);
+  const __m256 half = _mm256_set1_ps(CALIB_HALF);
+  const __m256i step = _mm256_set1_epi32(16*LATERO_CALIB_SIZE);
+  const __m256i low_bytes[2] = {
+    _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                     -1, -1, -1, -1, 0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1),
+    _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 0, 4, 8, 12, -1, -1, -1, -1,
+                     -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 4, 8, 12)
+  };
+  __m256i offsets[2];
+  int i, j;
+
+  offsets[0] = _mm256_setr_epi32(0, LATERO_CALIB_SIZE, 2*LATERO_CALIB_SIZE, 3*LATERO_CALIB_SIZE,
+                                 4*LATERO_CALIB_SIZE, 5*LATERO_CALIB_SIZE, 6*LATERO_CALIB_SIZE, 7*LATERO_CALIB_SIZE);
+  offsets[1] = _mm256_add_epi32(offsets[0], _mm256_set1_epi32(8*LATERO_CALIB_SIZE));
+
+  for (i=0; i+16<=n; i+=16) {
+    __m256i q = _mm256_setzero_si256();
+    for (j=0; j<2; ++j) {
+      __m256 take = _mm256_loadu_ps(ratio + i + 8*j);
+      __m256 x = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(from + i + 8*j), _mm256_sub_ps(one, take)),
+                               _mm256_mul_ps(_mm256_loadu_ps(to + i + 8*j), take));
+      q = _mm256_or_si256(q, QUANTIZE_AVX2_CALIB_STEP(x, j));
+      offsets[j] = _mm256_add_epi32(offsets[j], step);
+    }
+    _mm_storeu_si128((__m128i*) (raw + i), _mm_or_si128(_mm256_castsi256_si128(q), _mm256_extracti128_si256(q, 1)));
+  }
+  for (; i<n; ++i)
+    raw[i] = calib->table[i][calib_index(from[i], to[i], ratio[i])];
+}
+
+static const quantize_kernels_t quantize_avx2_kernels = {
+  quantize_avx2, quantize_avx2_f32, quantize_avx2_mix, quantize_avx2_f32_calib, quantize_avx2_mix_calib
+};
+
+#endif
+
+
+static int isa_supported(latero_isa isa)
+{
+  switch (isa) {
+    case LATERO_ISA_SCALAR:
+      return(1);
+#ifdef QUANTIZE_X86
+    case LATERO_ISA_SSE2:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("sse2");
+    case LATERO_ISA_AVX2:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2");
+#endif
+    default:
+      return(0);
+  }
+}
+
+
+static const quantize_kernels_t* isa_kernels(latero_isa isa)
+{
+  switch (isa) {
+#ifdef QUANTIZE_X86
+    case LATERO_ISA_SSE2:
+      return &quantize_sse2_kernels;
+    case LATERO_ISA_AVX2:
+      return &quantize_avx2_kernels;
+#endif
+    default:
+      return &quantize_scalar_kernels;
+  }
+}
+
+
+static const quantize_kernels_t* quantize_kernels(void)
+{
+  const quantize_kernels_t* kernels = __atomic_load_n(&quantize_impl, __ATOMIC_ACQUIRE);
+
+  if (kernels == NULL) {
+    latero_isa isa = LATERO_ISA_AVX2;
+    while (!isa_supported(isa))
+      isa = (latero_isa) (isa - 1);
+    latero_quantize_set_isa(isa);
+    kernels = __atomic_load_n(&quantize_impl, __ATOMIC_ACQUIRE);
+  }
+  return kernels;
+}
+
+
+/** @return ratio in fixed point, with one = 2^bits */
+static int32_t fixed_ratio(double ratio, int bits)
+{
+  double one = (double) (1 << bits);
+  double w = ratio * one + 0.5;
+  return (int32_t) (w > 0 ? (w < one ? w : one) : 0);
+}
+
+
+/***** PUBLIC API *****/
+
+void latero_quantize_pins(const double* from, const double* to, double ratio, uint8_t* raw, int n)
+{
+  quantize_kernels()->f64(from, to, ratio, raw, n);
+}
+
+
+void latero_quantize_pins_f32(const float* from, const float* to, float ratio, uint8_t* raw, int n)
+{
+  quantize_kernels()->f32(from, to, ratio, LATERO_MAX_RAW_PIN, raw, n);
+}
+
+
+void latero_quantize_pins_mix(const float* from, const float* to, const float* ratio, uint8_t* raw, int n)
+{
+  quantize_kernels()->mix(from, to, ratio, LATERO_MAX_RAW_PIN, raw, n);
+}
+
+
+void latero_quantize_pins_f32_calib(const float* from, const float* to, float ratio, const latero_calib_t* calib, uint8_t* raw, int n)
+{
+  quantize_kernels()->f32_calib(from, to, ratio, calib, raw, n);
+}
+
+
+void latero_quantize_pins_mix_calib(const float* from, const float* to, const float* ratio, const latero_calib_t* calib, uint8_t* raw, int n)
+{
+  quantize_kernels()->mix_calib(from, to, ratio, calib, raw, n);
+}
+
+
+void latero_quantize_pins_q15(const int16_t* from, const int16_t* to, double ratio, uint8_t* raw, int n)
+{
+  /* Q15 values are within [-1,1): nothing to clamp. Left to the compiler to vectorize. */
+  int32_t take = fixed_ratio(ratio, 15), keep = 32768 - take;
+  int i;
+  for (i=0; i<n; ++i) {
+    int32_t x = (from[i] * keep + to[i] * take) >> 15;
+    raw[i] = (uint8_t) (((x + 32768) * LATERO_MAX_RAW_PIN) >> 16);
+  }
+}
+
+
+void latero_quantize_pins_u8(const uint8_t* from, const uint8_t* to, double ratio, uint8_t* raw, int n)
+{
+  uint32_t take = fixed_ratio(ratio, 8), keep = 256 - take;
+  int i;
+  for (i=0; i<n; ++i) {
+    uint32_t x = from[i] * keep + to[i] * take; /* 256 * [0,255] */
+    uint32_t y = (x * LATERO_MAX_RAW_PIN) >> 8;
+    raw[i] = (uint8_t) ((y * 0x8081) >> 23); /* y / 255, exact for y < 2^16 */
+  }
+}
+
+
+int latero_quantize_set_isa(latero_isa isa)
+{
+  if (!isa_supported(isa))
+    return(-1);
+  __atomic_store_n(&quantize_isa, isa, __ATOMIC_RELAXED);
+  __atomic_store_n(&quantize_impl, isa_kernels(isa), __ATOMIC_RELEASE);
+  return(0);
+}
+
+
+latero_isa latero_quantize_get_isa(void)
+{
+  quantize_kernels();
+  return __atomic_load_n(&quantize_isa, __ATOMIC_RELAXED);
+}
+
+
+const char* latero_isa_name(latero_isa isa)
+{
+  switch (isa) {
+    case LATERO_ISA_SCALAR: return "scalar";
+    case LATERO_ISA_SSE2:   return "sse2";
+    case LATERO_ISA_AVX2:   return "avx2";
+    default:                return "unknown";
+  }
+}
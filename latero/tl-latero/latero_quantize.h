@@ -0,0 +1,87 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "latero_calib.h"
+
+/*
+ * Conversion of frames to raw blade values. A frame is blended, clamped and
+ * quantized in a single pass, vectorized with the widest instruction set
+ * supported by the running processor (selected at the first call). Frames can
+ * be given in double, float, Q15 or 8-bit precision, and are converted in that
+ * precision.
+ */
+
+/**
+ * Instruction sets of the quantization kernel.
+ */
+typedef enum
+{
+  LATERO_ISA_SCALAR, // portable C
+  LATERO_ISA_SSE2,   // 2 values per instruction (x86)
+  LATERO_ISA_AVX2    // 4 values per instruction (x86)
+} latero_isa;
+
+/**
+ * Compute raw blade values from a cross-fade between two frames.
+ * Each value is x = (1-ratio)*from[i] + ratio*to[i], clamped to [-1,1] (NaN
+ * counts as -1), and raw[i] = (0.5 + 0.5*x) * LATERO_MAX_RAW_PIN, truncated.
+ * Values go in the direction of RangeImg: -1 is raw 0, the opposite of
+ * latero_set_pins(). All instruction sets give the same bytes.
+ * @param from   n values faded out (can be the same as to)
+ * @param to     n values faded in
+ * @param ratio  progress of the fade, from 0 (from) to 1 (to)
+ * @param raw    n raw blade values
+ */
+void latero_quantize_pins(const double* from, const double* to, double ratio, uint8_t* raw, int n);
+
+/**
+ * As latero_quantize_pins(), for frames of floats, computed in single precision.
+ */
+void latero_quantize_pins_f32(const float* from, const float* to, float ratio, uint8_t* raw, int n);
+
+/**
+ * As latero_quantize_pins_f32(), with a ratio for each value, e.g. for pins
+ * fading at different paces: x = (1-ratio[i])*from[i] + ratio[i]*to[i].
+ */
+void latero_quantize_pins_mix(const float* from, const float* to, const float* ratio, uint8_t* raw, int n);
+
+/**
+ * As latero_quantize_pins_f32() and latero_quantize_pins_mix(), for calibrated
+ * pins: the value of pin i is looked up in table i of calib, at the index
+ * h + h*x, truncated, with h = (LATERO_CALIB_SIZE-1)/2 (see latero_calib.h).
+ * @param n  number of pins, up to LATERO_NB_PINS
+ */
+void latero_quantize_pins_f32_calib(const float* from, const float* to, float ratio, const latero_calib_t* calib, uint8_t* raw, int n);
+void latero_quantize_pins_mix_calib(const float* from, const float* to, const float* ratio, const latero_calib_t* calib, uint8_t* raw, int n);
+
+/**
+ * As latero_quantize_pins(), for Q15 frames (-32768 is -1.0, 32767 just under
+ * 1.0), computed in integer arithmetic. ratio is rounded to a multiple of 1/32768.
+ */
+void latero_quantize_pins_q15(const int16_t* from, const int16_t* to, double ratio, uint8_t* raw, int n);
+
+/**
+ * As latero_quantize_pins(), for 8-bit frames (0 is -1.0, 255 is 1.0), computed
+ * in integer arithmetic. ratio is rounded to a multiple of 1/256.
+ */
+void latero_quantize_pins_u8(const uint8_t* from, const uint8_t* to, double ratio, uint8_t* raw, int n);
+
+/**
+ * Force the instruction set of latero_quantize_pins(), e.g. to benchmark it.
+ * @return 0 on success, negative if the processor does not support it
+ */
+int latero_quantize_set_isa(latero_isa isa);
+
+/** @return instruction set used by latero_quantize_pins() */
+latero_isa latero_quantize_get_isa(void);
+
+/** @return name of an instruction set */
+const char* latero_isa_name(latero_isa isa);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,347 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#include "latero_uring.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define LATERO_HAVE_URING
+#endif
+#endif
+
+#ifdef LATERO_HAVE_URING
+
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define RING_ENTRIES 8
+
+/* indices of the registered buffers */
+#define BUF_PKT   0
+#define BUF_RSP   1
+#define BUF_FRAME 2
+
+/* user_data of the submitted operations */
+#define OP_SEND    1
+#define OP_RECV    2
+#define OP_TIMEOUT 3
+
+typedef struct
+{
+  int fd;
+  void *sq_ptr, *cq_ptr;
+  size_t sq_size, cq_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+  unsigned sq_pending; // prepared but not yet submitted
+  struct __kernel_timespec timeout;
+} latero_uring_t;
+
+
+/***** PRIVATE API *****/
+
+struct io_uring_sqe* uring_get_sqe(latero_uring_t* ring)
+{
+  unsigned tail = *ring->sq_tail + ring->sq_pending;
+  unsigned idx = tail & *ring->sq_mask;
+  struct io_uring_sqe* sqe = &ring->sqes[idx];
+
+  memset( sqe, 0, sizeof(*sqe) );
+  ring->sq_array[idx] = idx;
+  ring->sq_pending++;
+  return sqe;
+}
+
+
+/**
+ * Submit the prepared operations and wait for nb_ops completions.
+ * @param res  results of the operations, indexed by user_data
+ * @return 0 on success, -1 on error
+ */
+int uring_submit_and_wait(latero_uring_t* ring, unsigned nb_ops, int res[4])
+{
+  unsigned head, done = 0, submit = ring->sq_pending;
+  int rv;
+
+  __atomic_store_n( ring->sq_tail, *ring->sq_tail + submit, __ATOMIC_RELEASE );
+  ring->sq_pending = 0;
+
+  while (done < nb_ops) {
+    rv = syscall( __NR_io_uring_enter, ring->fd, submit, nb_ops - done, IORING_ENTER_GETEVENTS, NULL, 0 );
+    if (rv < 0 && errno != EINTR)
+      return(-1);
+    submit = 0;
+
+    head = *ring->cq_head;
+    while (head != __atomic_load_n( ring->cq_tail, __ATOMIC_ACQUIRE )) {
+      struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+      if (cqe->user_data < 4)
+        res[cqe->user_data] = cqe->res;
+      head++;
+      done++;
+    }
+    __atomic_store_n( ring->cq_head, head, __ATOMIC_RELEASE );
+  }
+  return(0);
+}
+
+
+void uring_prep_timeout(latero_uring_t* ring, int us_timeout)
+{
+  struct io_uring_sqe* sqe = uring_get_sqe( ring );
+
+  ring->timeout.tv_sec = us_timeout / 1000000;
+  ring->timeout.tv_nsec = (long long)(us_timeout % 1000000) * 1000;
+  sqe->opcode = IORING_OP_LINK_TIMEOUT;
+  sqe->fd = -1;
+  sqe->addr = (unsigned long) &ring->timeout;
+  sqe->len = 1;
+  sqe->user_data = OP_TIMEOUT;
+}
+
+
+void uring_prep_rw(latero_uring_t* ring, uint8_t opcode, int fd, void* buf, size_t len, int buf_index, uint64_t user_data)
+{
+  struct io_uring_sqe* sqe = uring_get_sqe( ring );
+
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->addr = (unsigned long) buf;
+  sqe->len = len;
+  sqe->buf_index = buf_index;
+  sqe->user_data = user_data;
+}
+
+
+/**
+ * Prepare a send of buf, from its registered copy if it is one of the
+ * registered buffers.
+ */
+void uring_prep_send(latero_t* latero, latero_uring_t* ring, const char* buf, size_t len)
+{
+  if (buf == latero->pktbuff)
+    uring_prep_rw( ring, IORING_OP_WRITE_FIXED, latero->udp_socket, (void*) buf, len, BUF_PKT, OP_SEND );
+  else if (buf == latero->framebuff)
+    uring_prep_rw( ring, IORING_OP_WRITE_FIXED, latero->udp_socket, (void*) buf, len, BUF_FRAME, OP_SEND );
+  else
+    uring_prep_rw( ring, IORING_OP_WRITE, latero->udp_socket, (void*) buf, len, 0, OP_SEND );
+}
+
+
+/**
+ * Prepare a receive into rspbuff, optionally bounded by a timeout.
+ * @return number of operations prepared
+ */
+unsigned uring_prep_recv(latero_t* latero, latero_uring_t* ring, int us_timeout)
+{
+  uring_prep_rw( ring, IORING_OP_READ_FIXED, latero->udp_socket, latero->rspbuff, BUFLEN, BUF_RSP, OP_RECV );
+  if (us_timeout < 0)
+    return(1);
+  ring->sqes[(*ring->sq_tail + ring->sq_pending - 1) & *ring->sq_mask].flags |= IOSQE_IO_LINK;
+  uring_prep_timeout( ring, us_timeout );
+  return(2);
+}
+
+
+/** @return number of bytes received, 0 on timeout, -1 on error */
+ssize_t uring_recv_result(int res)
+{
+  if (res >= 0)
+    return(res);
+  if (res == -ECANCELED || res == -ETIME || res == -EAGAIN || res == -EINTR)
+    return(0);
+  errno = -res;
+  return(-1);
+}
+
+
+/***** PUBLIC API *****/
+
+int latero_uring_open(latero_t* latero)
+{
+  struct io_uring_params p;
+  struct iovec iov[3];
+  latero_uring_t* ring;
+
+  latero_uring_close( latero );
+
+  ring = calloc( 1, sizeof(latero_uring_t) );
+  if (!ring)
+    return(-1);
+
+  memset( &p, 0, sizeof(p) );
+  ring->fd = syscall( __NR_io_uring_setup, RING_ENTRIES, &p );
+  if (ring->fd < 0) {
+    free( ring );
+    return(-1);
+  }
+  latero->uring = ring;
+
+  /* a single mmap for both rings is required, and link timeouts (which came along with NODROP) */
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP))
+    goto fail;
+
+  ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (ring->cq_size > ring->sq_size)
+    ring->sq_size = ring->cq_size;
+  ring->cq_size = 0; // shared with the submission ring
+
+  ring->sq_ptr = mmap( 0, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING );
+  if (ring->sq_ptr == MAP_FAILED) {
+    ring->sq_ptr = NULL;
+    goto fail;
+  }
+  ring->cq_ptr = ring->sq_ptr;
+
+  ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap( 0, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES );
+  if (ring->sqes == MAP_FAILED) {
+    ring->sqes = NULL;
+    goto fail;
+  }
+
+  ring->sq_head  = (unsigned*)((char*)ring->sq_ptr + p.sq_off.head);
+  ring->sq_tail  = (unsigned*)((char*)ring->sq_ptr + p.sq_off.tail);
+  ring->sq_mask  = (unsigned*)((char*)ring->sq_ptr + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned*)((char*)ring->sq_ptr + p.sq_off.array);
+  ring->cq_head  = (unsigned*)((char*)ring->cq_ptr + p.cq_off.head);
+  ring->cq_tail  = (unsigned*)((char*)ring->cq_ptr + p.cq_off.tail);
+  ring->cq_mask  = (unsigned*)((char*)ring->cq_ptr + p.cq_off.ring_mask);
+  ring->cqes     = (struct io_uring_cqe*)((char*)ring->cq_ptr + p.cq_off.cqes);
+
+  iov[BUF_PKT].iov_base = latero->pktbuff;
+  iov[BUF_PKT].iov_len  = BUFLEN;
+  iov[BUF_RSP].iov_base = latero->rspbuff;
+  iov[BUF_RSP].iov_len  = BUFLEN;
+  iov[BUF_FRAME].iov_base = latero->framebuff;
+  iov[BUF_FRAME].iov_len  = LATERO_FULL_LEN;
+  if (syscall( __NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iov, 3 ) < 0)
+    goto fail;
+
+  return(0);
+
+fail:
+  latero_uring_close( latero );
+  return(-1);
+}
+
+
+void latero_uring_close(latero_t* latero)
+{
+  latero_uring_t* ring = latero->uring;
+
+  if (!ring)
+    return;
+  if (ring->sqes)
+    munmap( ring->sqes, ring->sqes_size );
+  if (ring->sq_ptr)
+    munmap( ring->sq_ptr, ring->sq_size );
+  close( ring->fd );
+  free( ring );
+  latero->uring = NULL;
+}
+
+
+ssize_t latero_uring_send(latero_t* latero, const char* buf, size_t len)
+{
+  latero_uring_t* ring = latero->uring;
+  int res[4] = { 0, 0, 0, 0 };
+
+  uring_prep_send( latero, ring, buf, len );
+  if (uring_submit_and_wait( ring, 1, res ) < 0)
+    return(-1);
+  if (res[OP_SEND] < 0) {
+    errno = -res[OP_SEND];
+    return(-1);
+  }
+  return(res[OP_SEND]);
+}
+
+
+ssize_t latero_uring_recv(latero_t* latero, int us_timeout)
+{
+  latero_uring_t* ring = latero->uring;
+  int res[4] = { 0, 0, 0, 0 };
+  unsigned nb_ops;
+
+  /* no point in going through the ring for a poll */
+  if (us_timeout == 0)
+  {
+    ssize_t numbytes = recv( latero->udp_socket, latero->rspbuff, BUFLEN, MSG_DONTWAIT );
+    if (numbytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+      return(0);
+    return(numbytes);
+  }
+
+  nb_ops = uring_prep_recv( latero, ring, us_timeout );
+  if (uring_submit_and_wait( ring, nb_ops, res ) < 0)
+    return(-1);
+  return uring_recv_result( res[OP_RECV] );
+}
+
+
+ssize_t latero_uring_exchange(latero_t* latero, const char* buf, size_t len, int us_timeout)
+{
+  latero_uring_t* ring = latero->uring;
+  int res[4] = { 0, 0, 0, 0 };
+  unsigned nb_ops;
+
+  /* send, then receive: a failed send cancels the receive */
+  uring_prep_send( latero, ring, buf, len );
+  ring->sqes[(*ring->sq_tail + ring->sq_pending - 1) & *ring->sq_mask].flags |= IOSQE_IO_LINK;
+  nb_ops = 1 + uring_prep_recv( latero, ring, us_timeout );
+
+  if (uring_submit_and_wait( ring, nb_ops, res ) < 0)
+    return(-1);
+  if (res[OP_SEND] < 0) {
+    errno = -res[OP_SEND];
+    return(-1);
+  }
+  return uring_recv_result( res[OP_RECV] );
+}
+
+#else /* LATERO_HAVE_URING */
+
+int latero_uring_open(latero_t* latero)
+{
+  (void) latero;
+  return(-1);
+}
+
+void latero_uring_close(latero_t* latero)
+{
+  (void) latero;
+}
+
+ssize_t latero_uring_send(latero_t* latero, const char* buf, size_t len)
+{
+  (void) latero; (void) buf; (void) len;
+  errno = ENOSYS;
+  return(-1);
+}
+
+ssize_t latero_uring_recv(latero_t* latero, int us_timeout)
+{
+  (void) latero; (void) us_timeout;
+  errno = ENOSYS;
+  return(-1);
+}
+
+ssize_t latero_uring_exchange(latero_t* latero, const char* buf, size_t len, int us_timeout)
+{
+  (void) latero; (void) buf; (void) len; (void) us_timeout;
+  errno = ENOSYS;
+  return(-1);
+}
+
+#endif /* LATERO_HAVE_URING */
@@ -0,0 +1,52 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "latero.h"
+
+/*
+ * io_uring transport backend (Linux only). Requests go out of pktbuff or
+ * framebuff and responses come into rspbuff, which are registered with the ring
+ * as fixed buffers, and a complete exchange (send, receive and its timeout) costs
+ * a single system call.
+ * These functions are used internally by latero.c; select the backend with
+ * latero_set_transport().
+ */
+
+/**
+ * Set up a ring for a connection whose socket is connected to the Latero.
+ * @return 0 on success, negative if io_uring is not available
+ */
+int latero_uring_open(latero_t* latero);
+
+/** Tear down the ring, if any. */
+void latero_uring_close(latero_t* latero);
+
+/**
+ * Send len bytes of buf, preferably one of the registered buffers.
+ * @return number of bytes sent, -1 on error
+ */
+ssize_t latero_uring_send(latero_t* latero, const char* buf, size_t len);
+
+/**
+ * Receive a datagram into rspbuff.
+ * @param us_timeout  timeout [us], 0 to return immediately, negative to wait forever
+ * @return number of bytes received, 0 on timeout, -1 on error
+ */
+ssize_t latero_uring_recv(latero_t* latero, int us_timeout);
+
+/**
+ * Send len bytes of buf and receive the response into rspbuff, batched into a
+ * single submission.
+ * @param us_timeout  timeout [us] for the response, negative to wait forever
+ * @return number of bytes received, 0 on timeout, -1 on error
+ */
+ssize_t latero_uring_exchange(latero_t* latero, const char* buf, size_t len, int us_timeout);
+
+#ifdef __cplusplus
+}
+#endif
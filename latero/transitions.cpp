@@ -0,0 +1,147 @@
+#include "transitions.h"
+#include <math.h>
+#include <algorithm>
+#include <time.h>
+
+namespace latero {
+
+static const int NB_EASINGS = (int) Easing::Sine + 1;
+
+/** easing curves, sampled at CURVE_STEPS+1 points from 0 to 1 */
+struct EasingTables
+{
+	float values[NB_EASINGS][Transitions::CURVE_STEPS + 1];
+
+	EasingTables()
+	{
+		for (int i=0; i<=Transitions::CURVE_STEPS; ++i)
+		{
+			double t = (double) i / Transitions::CURVE_STEPS;
+			double u = 1.0 - t;
+			values[(int) Easing::Linear][i] = t;
+			values[(int) Easing::EaseIn][i] = t*t*t;
+			values[(int) Easing::EaseOut][i] = 1.0 - u*u*u;
+			values[(int) Easing::EaseInOut][i] = (t < 0.5) ? 4.0*t*t*t : 1.0 - 4.0*u*u*u;
+			values[(int) Easing::Sine][i] = 0.5 - 0.5*cos(M_PI*t);
+		}
+	}
+};
+
+/** @return the table of an easing curve, computed at the first call */
+static const float *Curve(Easing easing)
+{
+	static const EasingTables tables;
+	return tables.values[(int) easing];
+}
+
+/** @return value of an easing table at t, clamped to [0,1] */
+static inline float Interpolate(const float *curve, double t)
+{
+	t = (t > 0.0) ? t : 0.0; // NaN compares false
+	t = (t < 1.0) ? t : 1.0;
+	float x = (float) t * Transitions::CURVE_STEPS;
+	int i = std::min((int) x, Transitions::CURVE_STEPS - 1);
+	return curve[i] + (x - i) * (curve[i+1] - curve[i]);
+}
+
+
+Transitions::Transitions() :
+	head_(0), tail_(0), nbFading_(0)
+{
+	for (int i=0; i<LATERO_NB_PINS; ++i)
+	{
+		source_[i] = 0;
+		rate_[i] = 0;
+		phase_[i] = -1;
+		curve_[i] = Curve(Easing::Linear);
+	}
+}
+
+int64_t Transitions::Now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+float Transitions::Ease(Easing easing, float t)
+{
+	return Interpolate(Curve(easing), t);
+}
+
+bool Transitions::Begin(int64_t start, int64_t duration, Easing easing, const float *mask)
+{
+	unsigned int head = head_.load(std::memory_order_relaxed);
+	if (head - tail_.load(std::memory_order_acquire) >= MAX_PENDING)
+		return false;
+
+	Request &r = requests_[head % MAX_PENDING];
+	r.start = start;
+	r.duration = duration;
+	r.easing = easing;
+	r.masked = (mask != NULL);
+	if (mask)
+		for (int i=0; i<LATERO_NB_PINS; ++i)
+			r.mask[i] = mask[i];
+	head_.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+bool Transitions::End()
+{
+	return Begin(Now(), 0, Easing::Linear);
+}
+
+float Transitions::Progress_(int pin, double t) const
+{
+	return Interpolate(curve_[pin], t * rate_[pin] - phase_[pin]);
+}
+
+void Transitions::Apply(const float *target)
+{
+	unsigned int tail = tail_.load(std::memory_order_relaxed);
+	unsigned int head = head_.load(std::memory_order_acquire);
+	for (; tail != head; ++tail)
+	{
+		const Request &r = requests_[tail % MAX_PENDING];
+		const float *curve = Curve(r.easing);
+		for (int i=0; i<LATERO_NB_PINS; ++i)
+		{
+			float weight = r.masked ? r.mask[i] : 1.0f;
+			if (!(weight > 0.0f))
+				continue;
+
+			// start from where the pin is, clamped as it is displayed (NaN is -1)
+			float ratio = Progress_(i, r.start);
+			float x = source_[i] * (1.0f - ratio) + target[i] * ratio;
+			x = (x > -1.0f) ? x : -1.0f;
+			source_[i] = (x < 1.0f) ? x : 1.0f;
+
+			double span = weight * r.duration;
+			rate_[i] = (span >= 1.0) ? 1.0 / span : 0.0;
+			phase_[i] = (span >= 1.0) ? r.start * rate_[i] : -1.0;
+			curve_[i] = curve;
+		}
+		nbFading_ = LATERO_NB_PINS; // recounted by Evaluate()
+	}
+	tail_.store(tail, std::memory_order_release);
+}
+
+bool Transitions::Evaluate(int64_t now, float *ratio)
+{
+	if (nbFading_ == 0)
+		return false;
+
+	// pins whose fade is complete stay at 1
+	double t = (double) now;
+	int fading = 0;
+	for (int i=0; i<LATERO_NB_PINS; ++i)
+	{
+		ratio[i] = Progress_(i, t);
+		fading += (ratio[i] < 1.0f);
+	}
+	nbFading_ = fading;
+	return fading > 0;
+}
+
+}; // latero
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "tl-latero/latero.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+namespace latero {
+
+/** Pace of a fade over its duration. */
+enum class Easing
+{
+	Linear,
+	EaseIn,    // starts slowly (cubic)
+	EaseOut,   // ends slowly (cubic)
+	EaseInOut, // starts and ends slowly (cubic)
+	Sine       // starts and ends slowly (half cosine)
+};
+
+/**
+ * Fades of the pins of a display, from the value each pin had when its fade
+ * began to the frames displayed since. Pins fade on their own, so that fades
+ * can overlap and cover only some of the pins (masks). A fade that begins on a
+ * pin that is still fading starts from the value the pin has at that time:
+ * pins never jump. Values are those of RangeImg (-1.0 to 1.0).
+ *
+ * Fades are requested by one thread (Begin, End) and carried out by the thread
+ * that displays frames (Apply, Evaluate), without locks or memory allocation.
+ * Easing curves are evaluated from tables computed once.
+ */
+class Transitions
+{
+public:
+	/** number of requests that can wait for the display thread */
+	static const unsigned int MAX_PENDING = 16;
+
+	/** number of segments of the easing tables */
+	static const int CURVE_STEPS = 256;
+
+	Transitions();
+
+	/**
+	 * Request a fade (requesting thread).
+	 * @param start    time at which the fade begins [ns] (see Now)
+	 * @param duration duration of the fade [ns], 0 to end the fades of the pins at once
+	 * @param easing   pace of the fade
+	 * @param mask     LATERO_NB_PINS weights from 0 to 1, or NULL to fade all pins:
+	 *                 a pin fades over weight*duration, pins of weight 0 are left as they are
+	 * @return false if too many requests are pending (the request is dropped)
+	 */
+	bool Begin(int64_t start, int64_t duration, Easing easing, const float *mask = NULL);
+
+	/** Request that all fades complete at once (requesting thread). */
+	bool End();
+
+	/** @return true if requests wait for Apply() */
+	inline bool Pending() const
+	{
+		return head_.load(std::memory_order_acquire) != tail_.load(std::memory_order_relaxed);
+	}
+
+	/**
+	 * Start the requested fades (display thread). Must be called before the
+	 * pins are given new values.
+	 * @param target LATERO_NB_PINS values displayed so far, which fading pins are heading to
+	 */
+	void Apply(const float *target);
+
+	/** @return true if pins are fading (display thread) */
+	inline bool Active() const { return nbFading_ > 0; }
+
+	/**
+	 * Compute how far each pin has faded (display thread).
+	 * @param now   current time [ns]
+	 * @param ratio LATERO_NB_PINS ratios, from 0 (Sources) to 1 (the frame displayed)
+	 * @return false if no pin is fading, in which case ratio is left unset
+	 */
+	bool Evaluate(int64_t now, float *ratio);
+
+	/** @return LATERO_NB_PINS values the pins fade from (display thread) */
+	inline const float *Sources() const { return source_; }
+
+	/** @return eased progress of a fade, from its table, for t from 0 to 1 */
+	static float Ease(Easing easing, float t);
+
+	/** @return current time [ns] on the clock of fades (monotonic) */
+	static int64_t Now();
+
+private:
+	struct Request
+	{
+		int64_t start, duration;
+		Easing easing;
+		bool masked;
+		float mask[LATERO_NB_PINS];
+	};
+
+	/** @return how far a pin has faded at a time, from 0 to 1 */
+	float Progress_(int pin, double t) const;
+
+	// requests: single producer, single consumer ring
+	Request requests_[MAX_PENDING];
+	std::atomic<unsigned int> head_; // next request written (requesting thread)
+	std::atomic<unsigned int> tail_; // next request applied (display thread)
+
+	// state of each pin (display thread)
+	// progress at time t is t*rate_ - phase_, so that not fading is rate 0 and phase -1
+	float source_[LATERO_NB_PINS];       // value the pin fades from
+	double rate_[LATERO_NB_PINS];        // inverse of the duration of the fade [1/ns]
+	double phase_[LATERO_NB_PINS];       // time at which the fade began times rate_
+	const float *curve_[LATERO_NB_PINS]; // easing table
+	int nbFading_;
+};
+
+}; // latero
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+
+namespace latero {
+
+/**
+ * Lock-free triple buffer for passing the latest value from one writer thread to
+ * one reader thread. Neither side ever blocks: the writer fills a back buffer and
+ * publishes it, the reader picks up the most recent published buffer. Values
+ * published while the reader is not looking are overwritten (latest wins).
+ */
+template<class T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() : middle_(1), back_(0), front_(2) {}
+
+	/**
+	 * constructor
+	 * @param v initial value of all buffers
+	 */
+	TripleBuffer(const T &v) : middle_(1), back_(0), front_(2)
+	{
+		for (int i=0; i<3; ++i)
+			buffers_[i] = v;
+	}
+
+	/** @return buffer to fill before calling Publish() (writer only) */
+	inline T& WriteBuffer() { return buffers_[back_]; }
+
+	/** make the content of the write buffer available to the reader (writer only) */
+	inline void Publish()
+	{
+		back_ = middle_.exchange(back_ | FRESH, std::memory_order_acq_rel) & INDEX;
+	}
+
+	/** copy v to the write buffer and publish it (writer only) */
+	inline void Write(const T &v)
+	{
+		WriteBuffer() = v;
+		Publish();
+	}
+
+	/**
+	 * Fetch the most recently published buffer (reader only).
+	 * @return true if a new value was published since the last call
+	 */
+	inline bool Update()
+	{
+		if (!(middle_.load(std::memory_order_relaxed) & FRESH))
+			return false;
+		front_ = middle_.exchange(front_, std::memory_order_acq_rel) & INDEX;
+		return true;
+	}
+
+	/** @return buffer fetched by the last call to Update() (reader only) */
+	inline const T& ReadBuffer() const { return buffers_[front_]; }
+
+private:
+	enum { INDEX = 0x3, FRESH = 0x4 };
+
+	T buffers_[3];
+	std::atomic<int> middle_; // index of the shared buffer, plus FRESH if not read yet
+	int back_;  // index of the buffer owned by the writer
+	int front_; // index of the buffer owned by the reader
+};
+
+}; // latero
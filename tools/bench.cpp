@@ -0,0 +1,1019 @@
+/**
+ * Benchmarks of the Latero driver.
+ *
+ * Usage: latero-bench <benchmark> [-ip address] [-n iterations]
+ *
+ * Benchmarks:
+ *   wait        round-trip latency and CPU cost of each socket wait strategy
+ *   transport   round-trip latency and CPU cost of each transport backend
+ *   serialize   cost of packing and unpacking packets (no device needed)
+ *   alloc       check that TactileDisplay displays frames without allocating memory
+ *   quantize    cost of converting a faded frame to blade values (no device needed)
+ *   compose     cost of building a frame from layers or image expressions (no device needed)
+ *   pool        cost of the intermediate images of a tick with each taxel allocator (no device needed)
+ *   schedule    presentation error of frames scheduled ahead, and handling of late frames
+ *   synth       cost of the synthesizer voices computed with each frame (no device needed)
+ */
+
+#include "tl-latero/latero.h"
+#include "tl-latero/latero_quantize.h"
+#include "tactiledisplay.h"
+#include "compositor.h"
+#include "taxelpool.h"
+#include "synthesizer.h"
+#include <arpa/inet.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+// allocations made with operator new in any thread, counted for the alloc benchmark
+static std::atomic<long> allocations(0);
+
+void *operator new(size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void *p = malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	free(p);
+}
+
+namespace {
+
+struct Options
+{
+	std::string ip = "127.0.0.1";
+	long n = 20000;
+};
+
+/** @return CPU time (user + system) used by the process [s] */
+double CpuTime()
+{
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec*1e-6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec*1e-6;
+}
+
+/** print statistics of a set of latencies [us] */
+void PrintLatencies(const char *name, std::vector<double> &us, double cpu, long failed)
+{
+	std::sort(us.begin(), us.end());
+	double sum = 0;
+	for (double v : us)
+		sum += v;
+	size_t n = us.size();
+	printf("%-12s mean %8.1f  p50 %8.1f  p99 %8.1f  max %8.1f us  cpu %6.1f us/op  failed %ld\n",
+		name, sum/n, us[n/2], us[(n*99)/100], us[n-1], 1e6*cpu/n, failed);
+}
+
+bool IsFullResponse(const latero_pkt_t &response)
+{
+	return (response.hdr.type == PKT_TYPE_FULLR0) || (response.hdr.type == PKT_TYPE_FULLR1);
+}
+
+/** time n lockstep exchanges */
+void TimeExchanges(latero_t *latero, const char *name, long n)
+{
+	latero_pkt_t response;
+	for (int i=0; i<100; ++i)
+		latero_write(latero, &response);
+
+	std::vector<double> us, wakeup;
+	us.reserve(n);
+	wakeup.reserve(n);
+	long failed = 0;
+	double cpu0 = CpuTime();
+	for (long i=0; i<n; ++i)
+	{
+		auto t0 = std::chrono::steady_clock::now();
+		int rv = latero_write(latero, &response);
+		if (rv < 0 || !IsFullResponse(response))
+			failed++;
+		us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count());
+
+		// delay between the kernel receiving the response and the driver reading it
+		latero_timing_t timing;
+		if (rv == 0 && latero_get_timing(latero, &timing) == 0 && timing.kernel_rx_ns != 0)
+			wakeup.push_back((timing.wake_ns - timing.kernel_rx_ns) / 1000.0);
+	}
+	double cpu = CpuTime() - cpu0;
+	PrintLatencies(name, us, cpu, failed);
+	if (!wakeup.empty())
+		PrintLatencies("  wake-up", wakeup, cpu, n - wakeup.size());
+}
+
+int BenchWait(const Options &opt)
+{
+	static const struct { latero_wait_strategy strategy; const char *name; } strategies[] = {
+		{ LATERO_WAIT_SELECT, "select" },
+		{ LATERO_WAIT_CONNECTED, "connected" },
+		{ LATERO_WAIT_BLOCKING, "blocking" },
+		{ LATERO_WAIT_BUSY_POLL, "busy-poll" },
+	};
+
+	latero_t latero;
+	if (latero_open(&latero, opt.ip.c_str()) < 0)
+	{
+		fprintf(stderr, "latero_open() failed\n");
+		return 1;
+	}
+
+	for (const auto &s : strategies)
+	{
+		if (latero_set_wait_strategy(&latero, s.strategy) < 0)
+		{
+			printf("%-12s not available\n", s.name);
+			continue;
+		}
+
+		TimeExchanges(&latero, s.name, opt.n);
+	}
+
+	latero_close(&latero);
+	return 0;
+}
+
+int BenchTransport(const Options &opt)
+{
+	latero_t latero;
+	if (latero_open(&latero, opt.ip.c_str()) < 0)
+	{
+		fprintf(stderr, "latero_open() failed\n");
+		return 1;
+	}
+
+	latero_set_wait_strategy(&latero, LATERO_WAIT_CONNECTED);
+	TimeExchanges(&latero, "socket", opt.n);
+
+	if (latero_set_transport(&latero, LATERO_TRANSPORT_URING) < 0)
+		printf("%-12s not available\n", "io_uring");
+	else
+		TimeExchanges(&latero, "io_uring", opt.n);
+
+	latero_close(&latero);
+	return 0;
+}
+
+/*
+ * Field-by-field serializer used before the table-driven one, kept as a
+ * baseline. It always produced BUFLEN-byte packets.
+ */
+__attribute__((noinline)) void LegacyPackPacket(char* pktbuff, unsigned int length, latero_pkt_t* pkt)
+{
+	int ii, pos;
+	uint16_t tmp;
+	uint32_t tmpl;
+
+	if (length < sizeof (latero_pkt_t))
+		return;
+
+    pktbuff[0] = pkt->hdr.magic;
+    pktbuff[1] = pkt->hdr.version;
+    pktbuff[2] = pkt->hdr.type;
+	tmp =  htons(*(uint16_t*)&(pkt->hdr.seq));
+	memcpy(&pktbuff[3], &tmp, sizeof(uint16_t));
+
+	pos = 5;
+	switch (pkt->hdr.type) {
+		case PKT_TYPE_FULL: case PKT_TYPE_IO:
+            tmp =  htons(*(uint16_t*)&(pkt->full.dio_out));
+            memcpy(&pktbuff[pos], &tmp, sizeof(uint16_t));pos+=2;
+
+			//pktbuff[pos] = pkt->full.dio_out; pos+=2;
+
+			for( ii = 0 ; ii < 4 ; ii++ ) {
+				tmp = htons(*(uint16_t*)&(pkt->full.dac[ii]));
+				memcpy(&pktbuff[pos+2*ii], &tmp, sizeof(uint16_t) );
+			}
+			pos = pos+2*ii;
+			for( ii = 0 ; ii < 64 ; ii++ ) {
+				pktbuff[pos+ii] = pkt->full.blade[ii];
+			}
+			break;
+		case PKT_TYPE_FULLR0: case PKT_TYPE_FULLR1:
+            tmp =  htons(*(uint16_t*)&(pkt->fullr.dio_in));
+            memcpy(&pktbuff[pos], &tmp, sizeof(uint16_t));pos+=2;
+			//pktbuff[pos] = pkt->fullr.dio_in; pos+=2;
+
+			tmp =  htons(*(uint16_t*)&(pkt->fullr.ctrlstatus));
+			memcpy(&pktbuff[pos], &tmp, sizeof(uint16_t));pos+=2;
+			tmp =  htons(*(uint16_t*)&(pkt->fullr.iostatus));
+			memcpy(&pktbuff[pos], &tmp, sizeof(uint16_t));pos+=2;
+
+			for( ii = 0 ; ii < 4 ; ii++ ) {
+				tmpl = htonl(*(uint32_t*)&(pkt->fullr.quad[ii]));
+				memcpy(&pktbuff[pos+sizeof(uint32_t)*ii], &tmpl, sizeof(uint32_t) );
+			}
+			pos = pos+sizeof(uint32_t)*ii;
+			for( ii = 0 ; ii < 4 ; ii++ ) {
+				tmp = htons(*(uint16_t*)&(pkt->fullr.adc[ii]));
+				memcpy(&pktbuff[pos+sizeof(uint16_t)*ii], &tmp, sizeof(uint16_t) );
+			}
+			break;
+		case PKT_TYPE_RAW:	case PKT_TYPE_RAWR:
+			pktbuff[pos] = pkt->raw.command; pos++;
+			tmp =  htons(*(uint16_t*)&(pkt->raw.address));
+			memcpy(&pktbuff[pos], &tmp, sizeof(uint16_t));pos+=2;
+			tmp =  htons(*(uint16_t*)&(pkt->raw.data));
+			memcpy(&pktbuff[pos], &tmp, sizeof(uint16_t));pos+=2;
+			break;
+	}
+}
+
+
+__attribute__((noinline)) int LegacyUnpackPacket(char* buf, unsigned int length, latero_pkt_t* pkt)
+{
+	int ii, pos;
+
+    /* TODO Make this test more robust and based on actual received packet format
+            expected length. */
+	if (length < sizeof (latero_pkt_t)) { return(-1); }
+
+	pkt->hdr.magic      = buf[0];
+	pkt->hdr.version    = buf[1];
+	pkt->hdr.type       = buf[2];
+	pkt->hdr.seq        = ntohs(*(uint16_t*)(&buf[3]));
+	pos = 5;
+
+    /* Some basic sanity in case we receive another type of UDP packet */
+    /* Avoid crash and burn... */
+    if ( pkt->hdr.magic != LATERO_MAGIC_NB ) {
+        return(-1);
+    }
+
+	switch (pkt->hdr.type) {
+
+		case PKT_TYPE_FULL:
+        case PKT_TYPE_IO:
+			/* printf("Packet Type Full or IO\n"); */
+			pkt->full.dio_out = buf[pos]; pos+=2;
+			for( ii = 0 ; ii < 4 ; ii++ ) {
+				pkt->full.dac[ii] = ntohs(*(uint16_t*)(&buf[pos+2*ii]));
+			}
+			pos = pos+2*ii;
+			if (pkt->hdr.type == PKT_TYPE_FULL) {
+				for( ii = 0 ; ii < 64 ; ii++ ) {
+					pkt->full.blade[ii] = buf[pos+ii];
+				}
+			}
+			break;
+
+		case PKT_TYPE_RAW:
+        case PKT_TYPE_RAWR:
+			/* printf("Packet Type Raw \n"); */
+			pkt->raw.command = buf[pos]; pos++;
+			pkt->raw.address = ntohs(*(uint16_t*)(&buf[pos])); pos+=2;
+			pkt->raw.data    = ntohs(*(uint16_t*)(&buf[pos])); pos+=2;
+			break;
+
+		case PKT_TYPE_FULLR0:
+        case PKT_TYPE_FULLR1:
+			/*printf("Packet Type Full Response \n");*/
+
+			pkt->fullr.dio_in = ntohs(*(uint16_t*)(&buf[pos])); pos+=2;
+			pkt->fullr.ctrlstatus = ntohs(*(uint16_t*)(&buf[pos])); pos+=2;
+			pkt->fullr.iostatus   = ntohs(*(uint16_t*)(&buf[pos])); pos+=2;
+
+			for( ii = 0 ; ii < 4 ; ii++ ) {
+				pkt->fullr.quad[ii] = ntohl(*(uint32_t*)(&buf[pos+sizeof(uint32_t)*ii]));
+			}
+			pos = pos+sizeof(uint32_t)*ii;
+			for( ii = 0 ; ii < 4 ; ii++ ) {
+				pkt->fullr.adc[ii] = ntohs(*(uint16_t*)(&buf[pos+sizeof(uint16_t)*ii]));
+			}
+			break;
+        default:
+            return(-2);
+	}
+    return(0);
+}
+
+
+/** @return average time of n calls to f [ns] */
+template<class F>
+double TimeCalls(long n, F f)
+{
+	auto t0 = std::chrono::steady_clock::now();
+	for (long i=0; i<n; ++i)
+	{
+		f(i);
+		asm volatile("" ::: "memory"); // keep the compiler from merging iterations
+	}
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / n;
+}
+
+/** @return shortest average time of n calls to f over a few runs [ns], for comparisons that a single noisy run could flip */
+template<class F>
+double BestTimeCalls(long n, F f)
+{
+	double best = TimeCalls(n, f);
+	for (int run=1; run<5; ++run)
+		best = std::min(best, TimeCalls(n, f));
+	return best;
+}
+
+int BenchSerialize(const Options &opt)
+{
+	long n = opt.n * 100;
+	latero_pkt_t pkt, rsp, out;
+	memset(&pkt, 0, sizeof(pkt));
+	pkt.hdr.magic = LATERO_MAGIC_NB;
+	pkt.hdr.version = PKT_VER_REV;
+	pkt.hdr.type = PKT_TYPE_FULL;
+	pkt.full.dio_out = 0x1000;
+	for (int i=0; i<64; ++i)
+		pkt.full.blade[i] = i;
+
+	rsp = pkt;
+	rsp.hdr.type = PKT_TYPE_FULLR0;
+	for (int i=0; i<4; ++i)
+		rsp.fullr.quad[i] = 0x01020304 * i;
+
+	// the 1-byte offset makes multi-byte fields unaligned, as they are on the wire
+	alignas(8) char buf[BUFLEN+1], legacy[BUFLEN+1];
+	char *b = buf+1, *l = legacy+1;
+
+	LegacyPackPacket(l, BUFLEN, &pkt);
+	packPacket(b, BUFLEN, &pkt);
+	bool same = !memcmp(b, l, LATERO_FULL_LEN);
+
+	volatile uint8_t sink = 0;
+	double tLegacyPack = TimeCalls(n, [&](long i) { pkt.hdr.seq = i; LegacyPackPacket(l, BUFLEN, &pkt); sink = l[4]; });
+	double tPack = TimeCalls(n, [&](long i) { pkt.hdr.seq = i; packPacket(b, BUFLEN, &pkt); sink = b[4]; });
+
+	packPacket(b, BUFLEN, &rsp);
+	memcpy(l, b, LATERO_FULLR_LEN);
+	double tLegacyUnpack = TimeCalls(n, [&](long i) { l[4] = i; LegacyUnpackPacket(l, BUFLEN, &out); sink = out.hdr.seq; });
+	double tUnpack = TimeCalls(n, [&](long i) { b[4] = i; unpackPacket(b, LATERO_FULLR_LEN, &out); sink = out.hdr.seq; });
+	(void)sink;
+
+	printf("pack PKT_TYPE_FULL      legacy %6.1f ns  table %6.1f ns  (%d vs %d bytes, %s)\n",
+		tLegacyPack, tPack, BUFLEN, LATERO_FULL_LEN, same ? "same encoding" : "ENCODING DIFFERS");
+	printf("unpack PKT_TYPE_FULLR0  legacy %6.1f ns  table %6.1f ns\n", tLegacyUnpack, tUnpack);
+	return same ? 0 : 1;
+}
+
+/*
+ * Conversion of a faded frame to blade values as done before the fused kernel:
+ * blend, then invert (through float), then scale and truncate.
+ */
+void LegacyQuantize(const double *from, const double *to, double ratio, uint8_t *raw)
+{
+	double blend[LATERO_NB_PINS], pins[LATERO_NB_PINS];
+	for (int i=0; i<LATERO_NB_PINS; ++i)
+		blend[i] = (1.0-ratio)*from[i] + ratio*to[i];
+	for (int i=0; i<LATERO_NB_PINS; ++i)
+	{
+		float norm = -1*blend[i];
+		pins[i] = norm;
+	}
+	for (int i=0; i<LATERO_NB_PINS; ++i)
+		raw[i] = (0.5-0.5*pins[i]) * LATERO_MAX_RAW_PIN;
+}
+
+/**
+ * Save tables of 1024 entries, a different curve for each pin, and load them back.
+ * @return false if the tables loaded are not those saved, resampled
+ */
+bool LoadTestCalibration(latero_calib_t &calib)
+{
+	const int entries = 1024;
+	std::vector<uint8_t> tables(LATERO_NB_PINS * entries);
+	for (int pin=0; pin<LATERO_NB_PINS; ++pin)
+		for (int j=0; j<entries; ++j)
+			tables[pin*entries + j] = 5 + 140 * pow(j / (entries - 1.0), 0.7 + pin/64.0);
+
+	char path[] = "/tmp/latero-bench-XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0)
+		return false;
+	latero_calib_header_t hdr = { LATERO_CALIB_MAGIC, LATERO_CALIB_VERSION, LATERO_NB_PINS, entries, 0 };
+	bool written = write(fd, &hdr, sizeof(hdr)) == sizeof(hdr)
+		&& write(fd, tables.data(), tables.size()) == (ssize_t) tables.size();
+	close(fd);
+	int loaded = written ? latero_calib_load(&calib, path) : -1;
+	unlink(path);
+	if (loaded < 0)
+	{
+		printf("cannot load a calibration\n");
+		return false;
+	}
+
+	// each resampled entry stays within a raw step of the nearest entry of the file
+	int maxError = 0;
+	for (int pin=0; pin<LATERO_NB_PINS; ++pin)
+		for (int j=0; j<LATERO_CALIB_SIZE; ++j)
+		{
+			int k = (j * (entries - 1) + (LATERO_CALIB_SIZE - 1) / 2) / (LATERO_CALIB_SIZE - 1);
+			maxError = std::max(maxError, abs(calib.table[pin][j] - tables[pin*entries + k]));
+		}
+	if (maxError > 1)
+		printf("calibration resampled %d raw steps away\n", maxError);
+	return maxError <= 1;
+}
+
+int BenchQuantize(const Options &opt)
+{
+	long n = opt.n * 50;
+	alignas(32) double from[LATERO_NB_PINS], to[LATERO_NB_PINS];
+	alignas(32) float fromF[LATERO_NB_PINS], toF[LATERO_NB_PINS], ratios[LATERO_NB_PINS];
+	int16_t fromQ15[LATERO_NB_PINS], toQ15[LATERO_NB_PINS];
+	uint8_t from8[LATERO_NB_PINS], to8[LATERO_NB_PINS];
+	uint8_t raw[LATERO_NB_PINS], expected[LATERO_NB_PINS];
+	for (int i=0; i<LATERO_NB_PINS; ++i)
+	{
+		from[i] = -1.0 + 2.0*i/(LATERO_NB_PINS-1);
+		to[i] = 1.2*sin(0.3*i); // partly out of range
+		fromF[i] = from[i];
+		toF[i] = to[i];
+		ratios[i] = (i % 16)/15.0f;
+		fromQ15[i] = latero::RangeEncoding<int16_t>::Encode(from[i]);
+		toQ15[i] = latero::RangeEncoding<int16_t>::Encode(to[i]);
+		from8[i] = latero::RangeEncoding<uint8_t>::Encode(from[i]);
+		to8[i] = latero::RangeEncoding<uint8_t>::Encode(to[i]);
+	}
+	to[5] = NAN;
+	toF[5] = NAN;
+
+	// a calibration file of finer tables, which differ from pin to pin
+	latero_calib_t calib;
+	if (!LoadTestCalibration(calib))
+		return 1;
+
+	volatile uint8_t sink = 0;
+	double tLegacy = TimeCalls(n, [&](long i) { LegacyQuantize(from, to, (i & 255)/255.0, raw); sink = raw[i & 63]; });
+	printf("%-12s %6.1f ns/frame\n", "legacy", tLegacy);
+
+	// every instruction set must give the same bytes as the scalar version, for all ratios
+	bool same = true;
+	bool fast = true;
+	latero_isa best = latero_quantize_get_isa();
+	for (int isa=LATERO_ISA_SCALAR; isa<=LATERO_ISA_AVX2; ++isa)
+	{
+		const char *name = latero_isa_name((latero_isa) isa);
+		if (latero_quantize_set_isa((latero_isa) isa) < 0)
+		{
+			printf("%-12s not available\n", name);
+			continue;
+		}
+		for (int r=0; r<=1000; ++r)
+		{
+			latero_quantize_set_isa(LATERO_ISA_SCALAR);
+			latero_quantize_pins(from, to, r/1000.0, expected, LATERO_NB_PINS);
+			latero_quantize_set_isa((latero_isa) isa);
+			latero_quantize_pins(from, to, r/1000.0, raw, LATERO_NB_PINS);
+			same = same && !memcmp(raw, expected, LATERO_NB_PINS);
+
+			latero_quantize_set_isa(LATERO_ISA_SCALAR);
+			latero_quantize_pins_f32(fromF, toF, r/1000.0f, expected, LATERO_NB_PINS);
+			latero_quantize_set_isa((latero_isa) isa);
+			latero_quantize_pins_f32(fromF, toF, r/1000.0f, raw, LATERO_NB_PINS);
+			same = same && !memcmp(raw, expected, LATERO_NB_PINS);
+
+			// per-pin ratios, as used while pins fade at different paces
+			float mixed[LATERO_NB_PINS];
+			for (int i=0; i<LATERO_NB_PINS; ++i)
+				mixed[i] = ratios[(i + r) % LATERO_NB_PINS];
+			latero_quantize_set_isa(LATERO_ISA_SCALAR);
+			latero_quantize_pins_mix(fromF, toF, mixed, expected, LATERO_NB_PINS);
+			latero_quantize_set_isa((latero_isa) isa);
+			latero_quantize_pins_mix(fromF, toF, mixed, raw, LATERO_NB_PINS);
+			same = same && !memcmp(raw, expected, LATERO_NB_PINS);
+
+			// calibrated pins
+			latero_quantize_set_isa(LATERO_ISA_SCALAR);
+			latero_quantize_pins_f32_calib(fromF, toF, r/1000.0f, &calib, expected, LATERO_NB_PINS);
+			latero_quantize_set_isa((latero_isa) isa);
+			latero_quantize_pins_f32_calib(fromF, toF, r/1000.0f, &calib, raw, LATERO_NB_PINS);
+			same = same && !memcmp(raw, expected, LATERO_NB_PINS);
+			latero_quantize_set_isa(LATERO_ISA_SCALAR);
+			latero_quantize_pins_mix_calib(fromF, toF, mixed, &calib, expected, LATERO_NB_PINS);
+			latero_quantize_set_isa((latero_isa) isa);
+			latero_quantize_pins_mix_calib(fromF, toF, mixed, &calib, raw, LATERO_NB_PINS);
+			same = same && !memcmp(raw, expected, LATERO_NB_PINS);
+		}
+		double t = BestTimeCalls(n, [&](long i) { latero_quantize_pins(from, to, (i & 255)/255.0, raw, LATERO_NB_PINS); sink = raw[i & 63]; });
+		double tF = TimeCalls(n, [&](long i) { latero_quantize_pins_f32(fromF, toF, (i & 255)/255.0f, raw, LATERO_NB_PINS); sink = raw[i & 63]; });
+		double tMix = TimeCalls(n, [&](long i) { latero_quantize_pins_mix(fromF, toF, ratios, raw, LATERO_NB_PINS); sink = raw[i & 63]; });
+		double tCalib = BestTimeCalls(n, [&](long i) { latero_quantize_pins_f32_calib(fromF, toF, (i & 255)/255.0f, &calib, raw, LATERO_NB_PINS); sink = raw[i & 63]; });
+		printf("%-12s %6.1f ns/frame  float %6.1f ns/frame  per-pin %6.1f ns/frame  calibrated %6.1f ns/frame%s\n",
+			name, t, tF, tMix, tCalib, isa == best ? "  (selected)" : "");
+		// the tables must not cost more than the double precision frames they replace
+		if (isa == best && tCalib > t)
+		{
+			printf("calibrated frames slower than double precision frames with %s (%.1f > %.1f ns/frame)\n", name, tCalib, t);
+			fast = false;
+		}
+	}
+	latero_quantize_set_isa(best);
+
+	double tQ15 = TimeCalls(n, [&](long i) { latero_quantize_pins_q15(fromQ15, toQ15, (i & 255)/255.0, raw, LATERO_NB_PINS); sink = raw[i & 63]; });
+	double t8 = TimeCalls(n, [&](long i) { latero_quantize_pins_u8(from8, to8, (i & 255)/255.0, raw, LATERO_NB_PINS); sink = raw[i & 63]; });
+	printf("%-12s %6.1f ns/frame\n", "q15", tQ15);
+	printf("%-12s %6.1f ns/frame\n", "8-bit", t8);
+
+	// fading frame: overlapping eased fades over half of the pins, then the blend
+	latero::Transitions transitions;
+	latero::TactileDisplay::FadeMask mask(0.0f);
+	for (unsigned int x=0; x<mask.SizeX()/2; ++x)
+		for (unsigned int y=0; y<mask.SizeY(); ++y)
+			mask.Set(x, y, 1.0f - 0.1f*y);
+	const int64_t hour = 3600LL*1000000000;
+	transitions.Begin(0, hour, latero::Easing::Linear);
+	transitions.Apply(fromF);
+	transitions.Begin(1000, hour, latero::Easing::EaseInOut, mask.Data());
+	transitions.Apply(toF);
+	double tFade = TimeCalls(n, [&](long i)
+	{
+		transitions.Evaluate(i*1000, ratios);
+		latero_quantize_pins_mix(transitions.Sources(), toF, ratios, raw, LATERO_NB_PINS);
+		sink = raw[i & 63];
+	});
+	printf("%-12s %6.1f ns/frame\n", "fade", tFade);
+	(void)sink;
+
+	// linear tables stay within a raw step of the uncalibrated values
+	latero_calib_t linear;
+	latero_calib_linear(&linear);
+	int maxStep = 0;
+	for (int r=0; r<=1000; ++r)
+	{
+		latero_quantize_pins_f32(fromF, toF, r/1000.0f, expected, LATERO_NB_PINS);
+		latero_quantize_pins_f32_calib(fromF, toF, r/1000.0f, &linear, raw, LATERO_NB_PINS);
+		for (int i=0; i<LATERO_NB_PINS; ++i)
+			maxStep = std::max(maxStep, abs(raw[i] - expected[i]));
+	}
+	printf("linear calibration within %d raw steps\n", maxStep);
+	same = same && maxStep <= 1;
+
+	// tables past the travel of the actuators are refused
+	latero_calib_t beyond = linear;
+	beyond.table[7][200] = LATERO_MAX_RAW_PIN + 1;
+	bool refused = latero_calib_check(&linear) == 0 && latero_calib_check(&beyond) < 0;
+	printf("calibration past the travel %s\n", refused ? "refused" : "accepted");
+
+	if (!same)
+		printf("instruction sets give different blade values\n");
+	return (same && refused && fast) ? 0 : 1;
+}
+
+/** @return number of allocations made while displaying n frames with display, alternating between frames */
+template<class Img, class Display>
+long CountAllocations(long n, const Img (&frames)[2], Display display)
+{
+	for (long i=0; i<100; ++i)
+		display(frames[i%2]);
+
+	long a0 = allocations.load();
+	for (long i=0; i<n; ++i)
+		display(frames[i%2]);
+	return allocations.load() - a0;
+}
+
+int BenchAlloc(const Options &opt)
+{
+	typedef latero::TactileDisplay::Frame Frame;
+	latero::TactileDisplay display(opt.ip.c_str());
+	const latero::RangeImg frames[2] = { latero::RangeImg(8, 8, 0.5), latero::RangeImg(8, 8, -0.5) };
+	const Frame staticFrames[2] = { Frame(0.5), Frame(-0.5) };
+	auto write = [&](const latero::RangeImg &frame) { display.WriteFrame(frame); };
+	long n = std::min(opt.n, 5000L);
+
+	display.SetFadeDuration(0);
+	long steady = CountAllocations(n, frames, write);
+	if (display.GetLatencyStats().count == 0)
+	{
+		fprintf(stderr, "no response from the device\n");
+		return 1;
+	}
+
+	display.SetFadeDuration(3600*1000);
+	display.BeginFade();
+	long fading = CountAllocations(n, frames, write);
+	long fadingStatic = CountAllocations(n, staticFrames, [&](const Frame &frame) { display.WriteFrame(frame); });
+
+	// a fade begun with every frame, over the left half, while the first one goes on
+	latero::TactileDisplay::FadeMask mask(0.0f);
+	for (unsigned int x=0; x<mask.SizeX()/2; ++x)
+		for (unsigned int y=0; y<mask.SizeY(); ++y)
+			mask.Set(x, y, 1.0f);
+	long overlapping = CountAllocations(n, staticFrames, [&](const Frame &frame)
+	{
+		display.BeginFade(1000, latero::Easing::EaseInOut, &mask);
+		display.WriteFrame(frame);
+	});
+
+	// a voice of the synthesizer added to the frames, while the fades above go on
+	latero::Synthesizer::Voice voice;
+	voice.frequency = 250;
+	voice.amplitude = 0.2;
+	voice.SetPhaseGradient(0.125, 0);
+	display.GetSynthesizer().SetVoice(0, voice);
+	display.GetSynthesizer().NoteOn(0);
+	long voices = CountAllocations(n, staticFrames, [&](const Frame &frame) { display.WriteFrame(frame); });
+	display.GetSynthesizer().Stop();
+
+	// calibrated pins, taken up with the next frame
+	latero_calib_t calib;
+	latero_calib_linear(&calib);
+	display.SetCalibration(&calib);
+	long calibrated = CountAllocations(n, frames, write);
+	display.SetCalibration(NULL);
+
+	// frames published in between are skipped, but the streaming thread keeps exchanging
+	display.SetFadeDuration(0);
+	display.EndFade();
+	display.StartStreaming();
+	long streaming = CountAllocations(n, frames, [&](const latero::RangeImg &frame)
+	{
+		display.PublishFrame(frame);
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+	});
+	display.StopStreaming();
+
+	printf("steady      %ld allocations in %ld frames\n", steady, n);
+	printf("fading      %ld allocations in %ld frames\n", fading, n);
+	printf("static      %ld allocations in %ld frames\n", fadingStatic, n);
+	printf("overlapping %ld allocations in %ld frames\n", overlapping, n);
+	printf("voices      %ld allocations in %ld frames\n", voices, n);
+	printf("calibrated  %ld allocations in %ld frames\n", calibrated, n);
+	printf("streaming   %ld allocations in %ld frames\n", streaming, n);
+	return (steady || fading || fadingStatic || overlapping || voices || calibrated || streaming) ? 1 : 0;
+}
+
+int BenchCompose(const Options &opt)
+{
+	using latero::BlendMode;
+	long n = opt.n * 50;
+	latero::RangeImg base(8, 8), cursor(8, 8, 0.0), alert(8, 8), mask(8, 8, 0.0), frame(8, 8), legacy(8, 8), lazy(8, 8);
+	for (unsigned int i=0; i<base.Size(); ++i)
+	{
+		base.Set(i, sin(0.7*i));
+		alert.Set(i, (i % 2) ? 0.8 : -0.8);
+	}
+	for (unsigned int x=2; x<5; ++x)
+		for (unsigned int y=2; y<5; ++y)
+		{
+			cursor.Set(x, y, 1.0);
+			mask.Set(x, y, 1.0);
+		}
+
+	// what applications did: weighted sums with DoubleActuatorImg
+	auto sum = [&]()
+	{
+		legacy = base;
+		legacy += cursor.Mult(0.5);
+		legacy += alert.Mult(0.25);
+		for (unsigned int i=0; i<legacy.Size(); ++i)
+			legacy.Set(i, std::min(1.0, std::max(-1.0, legacy.Get(i))));
+	};
+
+	latero::Compositor added(8, 8);
+	added.AddLayer(base);
+	added.AddLayer(cursor, 0.5, BlendMode::Add);
+	added.AddLayer(alert, 0.25, BlendMode::Add);
+
+	latero::Compositor layered(8, 8);
+	layered.AddLayer(base);
+	layered.AddLayer(cursor, 1.0, BlendMode::Over, &mask);
+	layered.AddLayer(alert, 0.25, BlendMode::Max);
+
+	// the same sum as an expression, evaluated in one loop
+	auto expression = [&]()
+	{
+		lazy = base + cursor*0.5 + alert*0.25;
+		legacy = base;
+		legacy += cursor.Mult(0.5);
+		legacy += alert.Mult(0.25);
+	};
+	expression();
+	double diff = 0;
+	for (unsigned int i=0; i<lazy.Size(); ++i)
+		diff = std::max(diff, fabs(lazy.Get(i) - legacy.Get(i)));
+
+	sum();
+	added.Compose(frame);
+	for (unsigned int i=0; i<frame.Size(); ++i)
+		diff = std::max(diff, fabs(frame.Get(i) - legacy.Get(i)));
+
+	volatile double sink = 0;
+	long a0 = allocations.load();
+	double tLegacy = TimeCalls(n, [&](long i) { sum(); sink = legacy.Get(i & 63); });
+	long a1 = allocations.load();
+	double tAdded = TimeCalls(n, [&](long i) { added.Compose(frame); sink = frame.Get(i & 63); });
+	double tLayered = TimeCalls(n, [&](long i) { layered.Compose(frame); sink = frame.Get(i & 63); });
+	double tLazy = TimeCalls(n, [&](long i) { lazy = base + cursor*0.5 + alert*0.25; sink = lazy.Get(i & 63); });
+	long a2 = allocations.load();
+	(void)sink;
+
+	printf("%-12s %6.1f ns/frame  %.1f allocations/frame\n", "legacy", tLegacy, (double)(a1 - a0)/n);
+	printf("%-12s %6.1f ns/frame  %.1f allocations/frame  (max difference %.1g)\n", "compositor", tAdded, (double)(a2 - a1)/n, diff);
+	printf("%-12s %6.1f ns/frame  (mask, over and max)\n", "layered", tLayered);
+	printf("%-12s %6.1f ns/frame  (base + cursor*0.5 + alert*0.25, not clamped)\n", "expression", tLazy);
+	return (diff < 1e-9 && a2 == a1) ? 0 : 1;
+}
+
+/** print the timing and the taxel statistics of a tick */
+void PrintPool(const char *name, double ns, long heap, long n)
+{
+	latero::TaxelStats st = latero::TaxelPool::GetStats();
+	printf("%-12s %7.1f ns/tick  heap %5.2f/tick  cache %5.2f/tick  arena %5.2f/tick  overflows %lu  cached %zu bytes\n",
+		name, ns, (double) heap/n, (double) st.cacheReuses/n, (double) st.arenaAllocations/n, st.arenaOverflows, st.cachedBytes);
+}
+
+int BenchPool(const Options &opt)
+{
+	long n = opt.n * 10;
+	latero::RangeImg texture(8, 8), cursor(8, 8, 0.0), frame(8, 8);
+	for (unsigned int i=0; i<texture.Size(); ++i)
+		texture.Set(i, sin(0.7*i));
+	cursor.Set(3, 3, 1.0);
+
+	// a renderer that builds its frame from temporaries: copies, clones and scaled images
+	volatile double sink = 0;
+	auto tick = [&](long i)
+	{
+		latero::RangeImg scrolled = texture;
+		scrolled.Set(i & 63, 0.0);
+		latero::DoubleActuatorImg *layer = cursor.Clone();
+		latero::DoubleActuatorImg sum = scrolled.Mult(0.8);
+		sum += layer->Mult(0.5);
+		latero::RangeImg big(16, 16, 0.0); // e.g. a zoomed view
+		frame = sum + big.Data()[i & 255];
+		delete layer;
+		sink = frame.Get(i & 63);
+	};
+
+	// steady state of each allocator
+	latero::TaxelPool::ResetStats();
+	long a0 = allocations.load();
+	double tHeap = TimeCalls(n, tick);
+	PrintPool("heap", tHeap, allocations.load() - a0, n);
+
+	latero::TaxelPool::EnableThreadCache(true);
+	tick(0);
+	latero::TaxelPool::ResetStats();
+	a0 = allocations.load();
+	double tCache = TimeCalls(n, tick);
+	long cacheHeap = allocations.load() - a0;
+	PrintPool("cache", tCache, cacheHeap, n);
+	latero::TaxelPool::EnableThreadCache(false);
+
+	latero::TaxelArena arena(16*1024);
+	latero::TaxelPool::ResetStats();
+	a0 = allocations.load();
+	double tArena = TimeCalls(n, [&](long i)
+	{
+		{
+			latero::TaxelArena::Scope scope(arena);
+			tick(i);
+		}
+		arena.Reset();
+	});
+	long arenaHeap = allocations.load() - a0;
+	PrintPool("arena", tArena, arenaHeap, n);
+	printf("arena peak %zu of %zu bytes\n", arena.GetPeak(), arena.GetCapacity());
+	(void)sink;
+
+	// Clone() allocates the image itself, which no taxel allocator avoids
+	return (cacheHeap <= n && arenaHeap <= n) ? 0 : 1;
+}
+
+void PrintSchedule(const char *name, const latero::TactileDisplay::ScheduleStats &st)
+{
+	printf("%-12s presented %5lu  dropped %4lu  late %4lu  error mean %7.1f  max %7.1f us  max depth %u\n",
+		name, st.presented, st.dropped, st.late, st.MeanError(), st.errorMax, st.maxDepth);
+}
+
+int BenchSchedule(const Options &opt)
+{
+	typedef latero::TactileDisplay::Frame Frame;
+	latero::TactileDisplay display(opt.ip.c_str());
+	if (!display.StartStreaming())
+	{
+		fprintf(stderr, "no response from the device\n");
+		return 1;
+	}
+	display.SetFadeDuration(0);
+	const Frame frames[2] = { Frame(0.5), Frame(-0.5) };
+	const int64_t period = 2000000; // 500 Hz animation
+	long n = std::min(opt.n, 2000L);
+
+	// an animation scheduled ahead, fed in bursts as an application would
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	display.ResetScheduleStats();
+	int64_t start = latero::TactileDisplay::Now() + 20000000;
+	long failed = 0;
+	for (long i=0; i<n; ++i)
+	{
+		while (!display.ScheduleFrame(frames[i%2], start + i*period))
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			failed++;
+		}
+	}
+	int64_t end = start + n*period + 20000000;
+	std::this_thread::sleep_for(std::chrono::nanoseconds(std::max<int64_t>(0, end - latero::TactileDisplay::Now())));
+	latero::TactileDisplay::ScheduleStats ahead = display.GetScheduleStats();
+
+	// frames that arrive after their time: all but the latest are merged
+	display.ResetScheduleStats();
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	int64_t past = latero::TactileDisplay::Now() - 10000000;
+	for (int i=0; i<10; ++i)
+		display.ScheduleFrame(frames[i%2], past + i*period/10);
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	latero::TactileDisplay::ScheduleStats late = display.GetScheduleStats();
+	display.StopStreaming();
+
+	// nothing would present the frame
+	bool refused = !display.ScheduleFrame(frames[0], latero::TactileDisplay::Now());
+
+	PrintSchedule("ahead", ahead);
+	PrintSchedule("late", late);
+	printf("schedule full %ld times, %s once stopped\n", failed, refused ? "refused" : "accepted");
+	bool ok = (ahead.presented + ahead.dropped == (unsigned long) n) && late.presented == 1 && late.dropped == 9 && late.late == 1
+		&& refused;
+	return ok ? 0 : 1;
+}
+
+int BenchSynth(const Options &opt)
+{
+	typedef latero::Synthesizer Synth;
+	const long n = opt.n * 10;
+	const int64_t ms = 1000000;
+	float out[LATERO_NB_PINS];
+	volatile float sink = 0;
+	bool ok = true;
+
+	// one voice of each waveform, travelling across the array
+	const char *names[] = { "sine", "square", "triangle", "sawtooth", "noise" };
+	for (int w=0; w<5; ++w)
+	{
+		Synth synth;
+		Synth::Voice voice;
+		voice.waveform = (latero::Waveform) w;
+		voice.frequency = 250;
+		voice.amplitude = 0.5;
+		voice.SetPhaseGradient(0.125, 0);
+		synth.SetVoice(0, voice);
+		synth.NoteOn(0, 1);
+		long a0 = allocations.load();
+		double t = TimeCalls(n, [&](long i) { synth.Render(1 + i*250000, out); sink = out[i & 63]; });
+		ok = ok && allocations.load() == a0;
+		printf("%-12s %6.1f ns/frame\n", names[w], t);
+	}
+
+	// all voices, with envelopes
+	Synth synth;
+	for (int v=0; v<Synth::MAX_VOICES; ++v)
+	{
+		Synth::Voice voice;
+		voice.waveform = (latero::Waveform) (v % 5);
+		voice.frequency = 50 + 40*v;
+		voice.amplitude = 0.1;
+		voice.envelope.attack = 0.01;
+		voice.envelope.decay = 0.02;
+		voice.envelope.sustain = 0.5;
+		voice.SetPhaseGradient(0.1*v, 0.05);
+		synth.SetVoice(v, voice);
+		synth.NoteOn(v, 1);
+	}
+	long a0 = allocations.load();
+	double tAll = TimeCalls(n, [&](long i) { synth.Render(1 + i*250000, out); sink = out[i & 63]; });
+	ok = ok && allocations.load() == a0;
+	printf("%-12s %6.1f ns/frame\n", "8 voices", tAll);
+
+	// accuracy of the sine, against the library
+	Synth::Voice voice;
+	voice.frequency = 1000;
+	voice.amplitude = 1;
+	voice.SetPhaseGradient(1.0/LATERO_NB_PINS, 1.0/LATERO_NB_PINS_Y);
+	Synth sine;
+	sine.SetVoice(0, voice);
+	sine.NoteOn(0, 1);
+	double maxError = 0;
+	for (long i=0; i<1000; ++i)
+	{
+		int64_t t = 1 + i*37000;
+		sine.Render(t, out);
+		for (int p=0; p<LATERO_NB_PINS; ++p)
+		{
+			double phase = (t - 1)*1e-6 + voice.phase.Get(p);
+			maxError = std::max(maxError, fabs(out[p] - sin(2*M_PI*phase)));
+		}
+	}
+	printf("sine error %.4f\n", maxError);
+	ok = ok && maxError < 0.0012;
+
+	// envelope: attack, sustain, then silent once released
+	Synth adsr;
+	voice.waveform = latero::Waveform::Square;
+	voice.phase.Set(0.0f);
+	voice.envelope.attack = 0.01;
+	voice.envelope.sustain = 0.5;
+	voice.envelope.decay = 0.01;
+	voice.envelope.release = 0.01;
+	adsr.SetVoice(0, voice);
+	adsr.NoteOn(0, 100*ms);
+	adsr.NoteOff(0, 200*ms);
+	bool before = adsr.Render(50*ms, out);
+	adsr.Render(105*ms + 100000, out);
+	float attack = out[0];
+	adsr.Render(150*ms + 100000, out);
+	float sustain = out[0];
+	adsr.Render(205*ms + 100000, out);
+	float release = out[0];
+	bool after = adsr.Active(211*ms);
+	printf("envelope attack %.2f sustain %.2f release %.2f\n", attack, sustain, release);
+	ok = ok && !before && !after && fabs(attack - 0.5) < 0.02 && fabs(sustain - 0.5) < 1e-4 && fabs(release - 0.25) < 0.02;
+	(void)sink;
+
+	if (!ok)
+		printf("the synthesizer allocated memory or gave wrong values\n");
+	return ok ? 0 : 1;
+}
+
+void Usage()
+{
+	fprintf(stderr,
+		"Usage: latero-bench <benchmark> [-ip address] [-n iterations]\n"
+		"Benchmarks:\n"
+		"  wait        round-trip latency and CPU cost of each socket wait strategy\n"
+		"  transport   round-trip latency and CPU cost of each transport backend\n"
+		"  serialize   cost of packing and unpacking packets (no device needed)\n"
+		"  alloc       check that TactileDisplay displays frames without allocating memory\n"
+		"  quantize    cost of converting a faded frame to blade values (no device needed)\n"
+		"  compose     cost of building a frame from layers or image expressions (no device needed)\n"
+		"  pool        cost of the intermediate images of a tick with each taxel allocator (no device needed)\n"
+		"  schedule    presentation error of frames scheduled ahead, and handling of late frames\n"
+		"  synth       cost of the synthesizer voices computed with each frame (no device needed)\n");
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2)
+	{
+		Usage();
+		return 1;
+	}
+
+	Options opt;
+	for (int i=2; i<argc; ++i)
+	{
+		if (!strcmp(argv[i], "-ip") && i+1 < argc)
+			opt.ip = argv[++i];
+		else if (!strcmp(argv[i], "-n") && i+1 < argc)
+			opt.n = std::max(1L, atol(argv[++i]));
+		else
+		{
+			Usage();
+			return 1;
+		}
+	}
+
+	std::string bench = argv[1];
+	if (bench == "wait")
+		return BenchWait(opt);
+	if (bench == "transport")
+		return BenchTransport(opt);
+	if (bench == "serialize")
+		return BenchSerialize(opt);
+	if (bench == "alloc")
+		return BenchAlloc(opt);
+	if (bench == "quantize")
+		return BenchQuantize(opt);
+	if (bench == "compose")
+		return BenchCompose(opt);
+	if (bench == "pool")
+		return BenchPool(opt);
+	if (bench == "schedule")
+		return BenchSchedule(opt);
+	if (bench == "synth")
+		return BenchSynth(opt);
+
+	Usage();
+	return 1;
+}
@@ -0,0 +1,316 @@
+/**
+ * Latero device simulator.
+ *
+ * Listens for Latero packets over UDP and answers them the way the device does,
+ * so that the driver can be exercised and benchmarked without hardware. Encoder
+ * readings and button presses follow a script, and responses can be delayed,
+ * jittered, dropped and reordered.
+ *
+ * Usage: latero-sim [-ip address] [-port port] [-script file] [-latency us]
+ *                   [-jitter us] [-drop probability] [-reorder probability] [-seed n]
+ *
+ * A reordered response is sent after the response to the next request, or
+ * HOLD_US after it was due if no other request arrives by then.
+ *
+ * The script is a text file with one keyframe per line:
+ *     time_ms quad0 quad1 quad2 buttons
+ * where buttons is a bit mask (1: button 0 pressed, 2: button 1 pressed). Encoder
+ * counts are interpolated linearly between keyframes and the script loops once its
+ * last keyframe is reached. Lines starting with '#' are ignored.
+ */
+
+#include "tl-latero/latero.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// longest time a reordered response waits for the next one before it is sent anyway [us]
+const long HOLD_US = 2000;
+
+struct Options
+{
+	std::string ip = "127.0.0.1";
+	int port = PORT;
+	std::string script;
+	double latencyUs = 0;
+	double jitterUs = 0;
+	double drop = 0;
+	double reorder = 0;
+	unsigned int seed = 1;
+};
+
+struct Keyframe
+{
+	double t; // ms
+	double quad[3];
+	unsigned int buttons;
+};
+
+struct Response
+{
+	std::vector<char> data;
+	struct sockaddr_in to;
+};
+
+volatile sig_atomic_t stop = 0;
+
+void OnSignal(int)
+{
+	stop = 1;
+}
+
+/** default script: the carrier moves around and button 0 is clicked every two seconds */
+std::vector<Keyframe> DefaultScript()
+{
+	return {
+		{    0, {    0,     0,    0 }, 0 },
+		{  800, { 2000, -1500,  500 }, 0 },
+		{ 1000, { 2000, -1500,  500 }, 1 },
+		{ 1150, { 2000, -1500,  500 }, 0 },
+		{ 2000, {    0,     0,    0 }, 0 },
+	};
+}
+
+bool LoadScript(const std::string &filename, std::vector<Keyframe> &script)
+{
+	std::ifstream file(filename.c_str());
+	if (!file)
+		return false;
+
+	std::string line;
+	while (std::getline(file, line))
+	{
+		if (line.empty() || line[0] == '#')
+			continue;
+		std::istringstream is(line);
+		Keyframe k;
+		if (is >> k.t >> k.quad[0] >> k.quad[1] >> k.quad[2] >> k.buttons)
+			script.push_back(k);
+	}
+	return !script.empty();
+}
+
+/** state of the scripted inputs at time t (ms) */
+void EvalScript(const std::vector<Keyframe> &script, double t, uint32_t quad[4], unsigned int &buttons)
+{
+	double duration = script.back().t;
+	if (duration > 0)
+		t = fmod(t, duration);
+
+	size_t i = 0;
+	while (i+1 < script.size() && script[i+1].t <= t)
+		++i;
+	const Keyframe &k0 = script[i];
+	const Keyframe &k1 = (i+1 < script.size()) ? script[i+1] : script[i];
+	double r = (k1.t > k0.t) ? (t - k0.t) / (k1.t - k0.t) : 0;
+
+	for (int j=0; j<3; ++j)
+		quad[j] = (uint32_t)(int32_t)lround((1-r)*k0.quad[j] + r*k1.quad[j]);
+	quad[3] = 0;
+	buttons = k0.buttons;
+}
+
+void Usage()
+{
+	fprintf(stderr,
+		"Usage: latero-sim [-ip address] [-port port] [-script file] [-latency us]\n"
+		"                  [-jitter us] [-drop probability] [-reorder probability] [-seed n]\n");
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+	Options opt;
+	for (int i=1; i<argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "-h" || arg == "--help")
+		{
+			Usage();
+			return 0;
+		}
+		if (i+1 >= argc)
+		{
+			Usage();
+			return 1;
+		}
+		if (arg == "-ip") opt.ip = argv[++i];
+		else if (arg == "-port") opt.port = atoi(argv[++i]);
+		else if (arg == "-script") opt.script = argv[++i];
+		else if (arg == "-latency") opt.latencyUs = atof(argv[++i]);
+		else if (arg == "-jitter") opt.jitterUs = atof(argv[++i]);
+		else if (arg == "-drop") opt.drop = atof(argv[++i]);
+		else if (arg == "-reorder") opt.reorder = atof(argv[++i]);
+		else if (arg == "-seed") opt.seed = atoi(argv[++i]);
+		else
+		{
+			Usage();
+			return 1;
+		}
+	}
+
+	std::vector<Keyframe> script;
+	if (opt.script.empty())
+		script = DefaultScript();
+	else if (!LoadScript(opt.script, script))
+	{
+		fprintf(stderr, "cannot read script %s\n", opt.script.c_str());
+		return 1;
+	}
+
+	int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(opt.port);
+	addr.sin_addr.s_addr = inet_addr(opt.ip.c_str());
+	if (sock < 0 || bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+	{
+		perror("cannot listen");
+		return 1;
+	}
+	printf("Simulating a Latero on %s:%d\n", opt.ip.c_str(), opt.port);
+
+	signal(SIGINT, OnSignal);
+	signal(SIGTERM, OnSignal);
+
+	std::mt19937 rng(opt.seed);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	std::multimap<Clock::time_point, Response> pending; // responses waiting to be sent
+	bool holding = false; // a response is held back to be sent after the next one
+	Response held;
+	Clock::time_point heldUntil; // time at which the held response is sent if no other came
+	std::map<uint16_t, uint16_t> registers[2]; // raw registers of the controller and IO board
+	uint8_t page = 0;
+	long nbReceived = 0, nbSent = 0, nbDropped = 0, nbReordered = 0;
+	auto t0 = Clock::now();
+
+	while (!stop)
+	{
+		// wait for a request or for the next response to be due
+		long waitUs = 100000;
+		if (!pending.empty())
+		{
+			auto wait = std::chrono::duration_cast<std::chrono::microseconds>(pending.begin()->first - Clock::now());
+			waitUs = std::max(0L, (long)wait.count());
+		}
+		if (holding)
+		{
+			auto wait = std::chrono::duration_cast<std::chrono::microseconds>(heldUntil - Clock::now());
+			waitUs = std::max(0L, std::min(waitUs, (long)wait.count()));
+		}
+		struct timeval timeout;
+		timeout.tv_sec = waitUs / 1000000;
+		timeout.tv_usec = waitUs % 1000000;
+		fd_set readSet;
+		FD_ZERO(&readSet);
+		FD_SET(sock, &readSet);
+		if (select(sock+1, &readSet, 0, 0, &timeout) > 0)
+		{
+			char buf[BUFLEN];
+			Response rsp;
+			socklen_t slen = sizeof(rsp.to);
+			ssize_t n = recvfrom(sock, buf, sizeof(buf), 0, (struct sockaddr*)&rsp.to, &slen);
+			latero_pkt_t request, response;
+			if (n > 0 && unpackPacket(buf, n, &request) == 0)
+			{
+				nbReceived++;
+				memset(&response, 0, sizeof(response));
+				response.hdr.magic = LATERO_MAGIC_NB;
+				response.hdr.version = PKT_VER_REV;
+				response.hdr.seq = request.hdr.seq;
+
+				if (request.hdr.type == PKT_TYPE_FULL || request.hdr.type == PKT_TYPE_IO)
+				{
+					unsigned int buttons;
+					double t = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+					EvalScript(script, t, response.fullr.quad, buttons);
+					page = !page;
+					response.hdr.type = page ? PKT_TYPE_FULLR1 : PKT_TYPE_FULLR0;
+					response.fullr.dio_in = 0xFFFF;
+					if (buttons & 1) response.fullr.dio_in &= ~LATERO_BUTTON0_MASK;
+					if (buttons & 2) response.fullr.dio_in &= ~LATERO_BUTTON1_MASK;
+					response.fullr.ctrlstatus = 0x0114 | page; // version 1, rev 1, active
+					response.fullr.iostatus = 0x0110; // version 1, rev 1, no decoder error
+				}
+				else if (request.hdr.type == PKT_TYPE_RAW)
+				{
+					std::map<uint16_t, uint16_t> &reg = registers[(request.raw.command & PKT_RAW_CMD_IO) ? 1 : 0];
+					response.hdr.type = PKT_TYPE_RAWR;
+					response.raw.command = request.raw.command;
+					response.raw.address = request.raw.address;
+					if (request.raw.command & PKT_RAW_CMD_WR)
+						reg[request.raw.address] = request.raw.data;
+					response.raw.data = reg[request.raw.address];
+				}
+				else
+					continue;
+
+				rsp.data.resize(BUFLEN);
+				rsp.data.resize(packPacket(&rsp.data[0], BUFLEN, &response));
+
+				if (uniform(rng) < opt.drop)
+				{
+					nbDropped++;
+					continue;
+				}
+				double delayUs = opt.latencyUs + opt.jitterUs * (2*uniform(rng) - 1);
+				auto due = Clock::now() + std::chrono::microseconds((long)std::max(0.0, delayUs));
+				if (holding)
+				{
+					pending.insert(std::make_pair(due + std::chrono::microseconds(1), held));
+					holding = false;
+				}
+				if (uniform(rng) < opt.reorder)
+				{
+					held = rsp;
+					holding = true;
+					heldUntil = due + std::chrono::microseconds(HOLD_US);
+					nbReordered++;
+				}
+				else
+					pending.insert(std::make_pair(due, rsp));
+			}
+		}
+
+		// send due responses, and the held one once no other came in time
+		auto now = Clock::now();
+		if (holding && heldUntil <= now)
+		{
+			pending.insert(std::make_pair(now, held));
+			holding = false;
+		}
+		while (!pending.empty() && pending.begin()->first <= now)
+		{
+			const Response &rsp = pending.begin()->second;
+			sendto(sock, &rsp.data[0], rsp.data.size(), 0, (const struct sockaddr*)&rsp.to, sizeof(rsp.to));
+			nbSent++;
+			pending.erase(pending.begin());
+		}
+	}
+
+	printf("\nreceived %ld, sent %ld, dropped %ld, reordered %ld\n", nbReceived, nbSent, nbDropped, nbReordered);
+	close(sock);
+	return 0;
+}